@@ -0,0 +1,544 @@
+// benchmarks for the particle apps' gravity solvers, without a window.
+//
+//   c++ -O2 -std=c++17 -pthread -I<allolib>/include nbody-bench.cpp -o nbody-bench
+//   ./nbody-bench [particles]
+//   ./nbody-bench sweep [output prefix] [most particles] [ms a step]
+//
+// threads: the direct sum (nbody-kernel.hpp) at the given number of
+// particles (16k by default), Barnes-Hut (nbody-octree.hpp) at 8 times that
+// and particle-mesh (nbody-pm.hpp, 64 cells a side) at 64 times, on 1, 2, 4,
+// ... threads up to every core. prints each one's time per step, its speedup
+// over one thread, and whether the forces came out bit for bit the same as
+// with one thread.
+//
+// integrators: a cold cube of 1000 particles collapsing for 10 time units,
+// with the apps' semi-implicit Euler (without its drag and clamp, which take
+// energy out on purpose) and the block-timestep leapfrog of
+// nbody-leapfrog.hpp. prints the energy's worst drift from the start, the
+// force evaluations per simulated second and the time taken.
+//
+// sweep: every solver (the direct sum with each kernel this CPU has, then
+// Barnes-Hut and particle-mesh) on every thread count, at 100, 300, 1000,
+// ... particles up to a million (or the given most). each run steps the same
+// seeded cold cube 10 times with the solver's force and a kick-drift-kick
+// leapfrog (the apps' block leapfrog on one rung: a force evaluation a step,
+// and an energy error small enough not to hide a solver's), then keeps
+// stepping for the timing if that was quick. that step is the sweep's own,
+// labelled "kdk" in the output: the times are the solvers' under it, not
+// the apps' frames, whose euler step adds drag and a clamp, and whose pairs
+// loop (one thread, unsoftened, the direct sum's forces) isn't run here.
+// it reports:
+//   - ms a step and steps a second, force and integration together;
+//   - ns an interaction for the direct sums (n^2 of them a step; the
+//     approximate solvers don't do pairs, and show nothing);
+//   - the heap the run holds once it has stepped (the solver's trees, grids
+//     and buffers and the particles' state) over what was in use before;
+//   - whether the physics held: the median error of the first step's forces
+//     against the exact sum (nbody-forces.hpp), the total momentum (which
+//     pair forces keep at zero) against the momentum there is, and the
+//     energy's drift and how much of the energy the collapse released is
+//     missing or extra (the exact sum's is the integrator's, about 1e-2 at
+//     a few hundred particles and less with more).
+// a run whose step would take longer than the limit (2 s by default, going
+// by the last size) is skipped. writes <prefix>.csv (a row a run) and
+// <prefix>.json (the same with the settings), "nbody-sweep" by default, and
+// exits with 1 if any run broke the physics.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "al/math/al_Random.hpp"
+#include "nbody-kernel.hpp"
+#include "nbody-leapfrog.hpp"
+#include "nbody-octree.hpp"
+#include "nbody-pm.hpp"
+
+using namespace al;
+using namespace std;
+
+template <class F>
+double bestOf(int runs, F f) {
+  double best = 1e9;
+  for (int r = 0; r < runs; r++) {
+    auto t0 = chrono::steady_clock::now();
+    f();
+    double ms =
+        chrono::duration<double, milli>(chrono::steady_clock::now() - t0)
+            .count();
+    if (ms < best) best = ms;
+  }
+  return best;
+}
+
+// as the apps start: a uniform cube 10 units wide
+vector<Vec3f> cube(size_t n) {
+  rnd::Random<> random(1);
+  vector<Vec3f> p(n);
+  for (auto& q : p)
+    q = Vec3f(random.uniformS(), random.uniformS(), random.uniformS()) * 5;
+  return p;
+}
+
+bool same(const vector<Vec3f>& a, const vector<Vec3f>& b) {
+  return memcmp(a.data(), b.data(), a.size() * sizeof(Vec3f)) == 0;
+}
+
+vector<int> threadCounts() {
+  int cores = max(1u, thread::hardware_concurrency());
+  vector<int> counts;
+  for (int t = 1; t < cores; t *= 2) counts.push_back(t);
+  counts.push_back(cores);
+  return counts;
+}
+
+void threads(size_t n) {
+  const float G = 0.1f, softening = 0.05f, theta = 0.7f;
+  printf("threads (%u cores, %s kernel)\n", thread::hardware_concurrency(),
+         kernelName(bestKernel()));
+  printf("%-14s %10s %8s %10s %9s %10s\n", "solver", "particles", "threads",
+         "ms/step", "speedup", "identical");
+
+  vector<Vec3f> positions = cube(n), reference;
+  double one = 0;
+  for (int t : threadCounts()) {
+    ThreadPool pool(t);
+    DirectSum direct;
+    vector<Vec3f> forces;
+    double ms = bestOf(3, [&]() {
+      forces.assign(n, Vec3f(0, 0, 0));
+      direct.accumulate(positions, G, softening, forces, pool);
+    });
+    if (t == 1) {
+      one = ms;
+      reference = forces;
+    }
+    printf("%-14s %10zu %8d %10.2f %9.2f %10s\n", "direct", n, t, ms,
+           one / ms, same(forces, reference) ? "yes" : "NO");
+  }
+
+  positions = cube(8 * n);
+  for (int t : threadCounts()) {
+    ThreadPool pool(t);
+    Octree octree;
+    vector<Vec3f> forces;
+    double ms = bestOf(3, [&]() {
+      forces.assign(positions.size(), Vec3f(0, 0, 0));
+      octree.build(positions);
+      octree.accumulate(G, theta, softening, forces, pool);
+    });
+    if (t == 1) {
+      one = ms;
+      reference = forces;
+    }
+    printf("%-14s %10zu %8d %10.2f %9.2f %10s\n", "barnes-hut",
+           positions.size(), t, ms, one / ms,
+           same(forces, reference) ? "yes" : "NO");
+  }
+
+  positions = cube(64 * n);
+  for (int t : threadCounts()) {
+    ThreadPool pool(t);
+    ParticleMesh pm;
+    vector<Vec3f> forces;
+    double ms = bestOf(3, [&]() {
+      forces.assign(positions.size(), Vec3f(0, 0, 0));
+      pm.accumulate(positions, G, softening, forces, pool);
+    });
+    if (t == 1) {
+      one = ms;
+      reference = forces;
+    }
+    printf("%-14s %10zu %8d %10.2f %9.2f %10s\n", "particle-mesh",
+           positions.size(), t, ms, one / ms,
+           same(forces, reference) ? "yes" : "NO");
+  }
+}
+
+// as the apps start: at rest, masses around 3
+vector<float> masses(size_t n) {
+  rnd::Random<> random(2);
+  vector<float> m(n);
+  for (auto& x : m) x = max(0.5f, 3 + random.normal() / 2);
+  return m;
+}
+
+void integrators() {
+  const size_t n = 1000;
+  const float G = 0.1f, softening = 0.05f, duration = 10;
+  printf("\nintegrators (%zu particles, %g time units)\n", n, duration);
+  printf("%-14s %8s %8s %8s %12s %14s %10s\n", "integrator", "dt", "levels",
+         "eta", "drift", "evals/time", "ms");
+
+  ThreadPool pool;
+  DirectSum direct;
+  const vector<float> mass = masses(n);
+  auto start = [&](vector<Vec3f>& x, vector<Vec3f>& v) {
+    x = cube(n);
+    v.assign(n, Vec3f(0, 0, 0));
+    return energy(x, v, mass, G, softening).total();
+  };
+  auto drift = [&](const vector<Vec3f>& x, const vector<Vec3f>& v, double e0) {
+    return fabs(energy(x, v, mass, G, softening).total() - e0) / fabs(e0);
+  };
+
+  for (float dt : {0.1f, 0.025f, 0.00625f}) {
+    vector<Vec3f> x, v, a;
+    double e0 = start(x, v), worst = 0;
+    int steps = lround(duration / dt);
+    auto t0 = chrono::steady_clock::now();
+    for (int s = 0; s < steps; s++) {
+      a.assign(n, Vec3f(0, 0, 0));
+      direct.accumulate(x, G, softening, a, pool);
+      for (size_t i = 0; i < n; i++) {
+        v[i] += a[i] / mass[i] * dt;
+        x[i] += v[i] * dt;
+      }
+      if ((s + 1) % max(1, steps / 10) == 0) worst = max(worst, drift(x, v, e0));
+    }
+    double ms =
+        chrono::duration<double, milli>(chrono::steady_clock::now() - t0)
+            .count();
+    printf("%-14s %8g %8s %8s %11.3f%% %14.0f %10.1f\n", "euler", dt, "-",
+           "-", worst * 100, n / dt, ms);
+  }
+
+  // one rung is the plain (global step) leapfrog
+  pair<int, float> settings[] = {{0, 0}, {6, 0.02f}, {6, 0.005f}, {6, 0.001f}};
+  for (auto setting : settings) {
+    vector<Vec3f> x, v;
+    double e0 = start(x, v), worst = 0;
+    BlockLeapfrog leapfrog;
+    leapfrog.levels = setting.first;
+    leapfrog.eta = setting.second;
+    const float dt = 0.1f;
+    int steps = lround(duration / dt);
+    double measuring = 0;  // the energy checks' time, not the integrator's
+    auto t0 = chrono::steady_clock::now();
+    for (int s = 0; s < steps; s++) {
+      leapfrog.step(x, v, mass, dt, softening,
+                    [&](const vector<uint32_t>& active, vector<Vec3f>& f) {
+                      direct.accumulate(x, active, G, softening, f, pool);
+                    });
+      if ((s + 1) % (steps / 10) == 0) {
+        auto t1 = chrono::steady_clock::now();
+        worst = max(worst, drift(x, v, e0));
+        measuring += chrono::duration<double, milli>(
+                         chrono::steady_clock::now() - t1).count();
+      }
+    }
+    double ms =
+        chrono::duration<double, milli>(chrono::steady_clock::now() - t0)
+            .count() - measuring;
+    printf("%-14s %8g %8d %8g %11.3f%% %14.0f %10.1f\n", "leapfrog", dt,
+           leapfrog.levels, leapfrog.eta, worst * 100,
+           leapfrog.evaluations / leapfrog.simulated, ms);
+  }
+}
+
+// the solvers a sweep runs, each as the apps call it
+struct SweepSolver {
+  enum Kind { DIRECT, BARNES_HUT, PARTICLE_MESH } kind;
+  ForceKernel kernel;
+  double exponent;  // how its step time grows with the particles
+  double error, momentum, balance;  // the most each check may come to
+  string name() const {
+    if (kind == DIRECT) return string("direct-") + kernelName(kernel);
+    return kind == BARNES_HUT ? "barnes-hut" : "particle-mesh";
+  }
+};
+
+vector<SweepSolver> sweepSolvers() {
+  vector<SweepSolver> s;
+  for (int k = 0; k <= int(bestKernel()); k++)
+    s.push_back({SweepSolver::DIRECT, ForceKernel(k), 2, 1e-5, 1e-4, 2e-2});
+  s.push_back({SweepSolver::BARNES_HUT, bestKernel(), 1.2, 1e-2, 1e-2, 2e-2});
+  // mostly the grid's cost; and its force is of a potential blurred over a
+  // cell, not the softened one the energy is measured with
+  s.push_back({SweepSolver::PARTICLE_MESH, bestKernel(), 0.3, 0.2, 1e-2, 0.5});
+  return s;
+}
+
+// a solver's state, stepping x and v kick-drift-kick: the force at the end
+// of a step is the one the next starts with, so once started it is one
+// evaluation a step
+struct SweepStepper {
+  SweepSolver solver;
+  DirectSum direct;
+  Octree octree;
+  ParticleMesh pm;
+  vector<Vec3f> f;
+
+  void start(const vector<Vec3f>& x, float G, ThreadPool& pool) {
+    forces(x, G, pool);
+  }
+
+  void step(vector<Vec3f>& x, vector<Vec3f>& v, const vector<float>& m,
+            float G, float dt, ThreadPool& pool) {
+    auto kick = [&]() {
+      pool.parallelFor(x.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) v[i] += f[i] / m[i] * (dt / 2);
+      });
+    };
+    kick();
+    pool.parallelFor(x.size(), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) x[i] += v[i] * dt;
+    });
+    forces(x, G, pool);
+    kick();
+  }
+
+  void forces(const vector<Vec3f>& x, float G, ThreadPool& pool) {
+    const float softening = 0.05f, theta = 0.7f;
+    f.assign(x.size(), Vec3f(0, 0, 0));
+    if (solver.kind == SweepSolver::DIRECT) {
+      direct.kernel = solver.kernel;
+      direct.accumulate(x, G, softening, f, pool);
+    } else if (solver.kind == SweepSolver::BARNES_HUT) {
+      octree.build(x);
+      octree.accumulate(G, theta, softening, f, pool);
+    } else {
+      pm.accumulate(x, G, softening, f, pool);
+    }
+  }
+};
+
+// the energy as energy() has it, on the pool. past exact particles the
+// potential is each of a fixed sample of them against everyone, scaled up;
+// the same sample at the start and the end of a run, so the change in it
+// still follows the real one
+Energy sweepEnergy(const vector<Vec3f>& x, const vector<Vec3f>& v,
+                   const vector<float>& m, float G, ThreadPool& pool,
+                   size_t exact) {
+  const double e2 = 0.05 * 0.05;
+  size_t n = x.size(), stride = n <= exact ? 1 : (n + 1023) / 1024;
+  vector<double> phi((n + stride - 1) / stride);
+  pool.parallelFor(phi.size(), [&](size_t begin, size_t end) {
+    for (size_t k = begin; k < end; k++) {
+      size_t i = k * stride;
+      double sum = 0;
+      for (size_t j = 0; j < n; j++) {
+        double dx = x[j].x - x[i].x, dy = x[j].y - x[i].y,
+               dz = x[j].z - x[i].z;
+        if (j != i) sum += 1 / sqrt(dx * dx + dy * dy + dz * dz + e2);
+      }
+      phi[k] = sum;
+    }
+  });
+  Energy e;
+  for (double p : phi) e.potential -= G / 2 * p;
+  e.potential *= double(n) / phi.size();
+  for (size_t i = 0; i < n; i++) e.kinetic += 0.5 * m[i] * v[i].magSqr();
+  return e;
+}
+
+// heap in use, in MB (0 where it can't be had); glibc's big blocks are
+// mapped on their own and counted apart
+double heapMB() {
+#if defined(__APPLE__)
+  malloc_statistics_t stats;
+  malloc_zone_statistics(nullptr, &stats);
+  return stats.size_in_use / double(1 << 20);
+#elif defined(__GLIBC__)
+  struct mallinfo2 info = mallinfo2();
+  return (info.uordblks + info.hblkhd) / double(1 << 20);
+#else
+  return 0;
+#endif
+}
+
+// x as the stream would write it, or none for a measure that doesn't apply
+string orNone(double x, const char* none) {
+  if (isnan(x)) return none;
+  ostringstream s;
+  s << x;
+  return s.str();
+}
+
+struct SweepRun {
+  string solver;
+  size_t particles;
+  int threads, steps;
+  double ms, nsPerInteraction, stepsPerSecond, memoryMB;
+  double error, momentum, drift, balance;
+  bool sampled, ok;
+};
+
+bool sweep(const string& prefix, size_t most, double limitMs) {
+  // G shrinks as the particles grow so every size collapses alike, at the
+  // pull of the apps' 1000 particles at G 0.1
+  const float charge = 100, dt = 0.01f;
+  const int checked = 10;  // steps the physics is checked over
+  const size_t exact = 8192;  // particles whose energy is summed in full
+  printf("solver sweep under the bench's own kdk step, not the apps' euler "
+         "step (%u cores, up to %zu particles, %g ms a step at most)\n",
+         thread::hardware_concurrency(), most, limitMs);
+  printf("%-16s %9s %7s %10s %9s %10s %6s %9s %9s %9s %9s %4s\n", "solver",
+         "particles", "threads", "ms/step", "ns/inter", "steps/s", "MB",
+         "error", "momentum", "drift", "balance", "ok");
+
+  vector<SweepRun> runs;
+  vector<SweepSolver> solvers = sweepSolvers();
+  vector<int> counts = threadCounts();
+  // the last size each solver and thread count ran at, and its time
+  vector<vector<pair<size_t, double>>> last(
+      solvers.size(), vector<pair<size_t, double>>(counts.size(), {0, 0}));
+  vector<size_t> sizes;
+  for (size_t n = 100; n <= most; n *= 10) {
+    sizes.push_back(n);
+    if (3 * n <= most) sizes.push_back(3 * n);
+  }
+
+  for (size_t n : sizes) {
+    const vector<Vec3f> x0 = cube(n);
+    const vector<float> mass = masses(n);
+    const float G = charge / n;
+    for (size_t c = 0; c < counts.size(); c++) {
+      ThreadPool pool(counts[c]);
+      const vector<Vec3f> rest(n, Vec3f(0, 0, 0));
+      Energy start = sweepEnergy(x0, rest, mass, G, pool, exact);
+      for (size_t s = 0; s < solvers.size(); s++) {
+        auto& previous = last[s][c];
+        if (previous.first > 0 &&
+            previous.second * pow(double(n) / previous.first,
+                                  solvers[s].exponent) > limitMs) {
+          printf("%-16s %9zu %7d %10s\n", solvers[s].name().c_str(), n,
+                 counts[c], "skipped");
+          continue;
+        }
+
+        double heap = heapMB();
+        vector<Vec3f> x = x0, v(n, Vec3f(0, 0, 0));
+        SweepStepper stepper;
+        stepper.solver = solvers[s];
+        stepper.start(x, G, pool);
+        ForceError error = measureForceError(
+            x, G, 0.05f, 32, [&](size_t i) { return stepper.f[i]; });
+        auto t0 = chrono::steady_clock::now();
+        for (int k = 0; k < checked; k++) stepper.step(x, v, mass, G, dt, pool);
+        double elapsed = chrono::duration<double, milli>(
+                             chrono::steady_clock::now() - t0).count();
+        Energy end = sweepEnergy(x, v, mass, G, pool, exact);
+        Vec3f p(0, 0, 0);
+        double moving = 0;
+        for (size_t i = 0; i < n; i++) {
+          p += v[i] * mass[i];
+          moving += v[i].mag() * mass[i];
+        }
+
+        // quick ones carry on, for a time worth measuring
+        int steps = checked;
+        t0 = chrono::steady_clock::now();
+        double more = 0;
+        while (elapsed + more < 200) {
+          stepper.step(x, v, mass, G, dt, pool);
+          steps++;
+          more = chrono::duration<double, milli>(
+                     chrono::steady_clock::now() - t0).count();
+        }
+        double ms = (elapsed + more) / steps;
+        previous = {n, ms};
+
+        SweepRun r;
+        r.solver = solvers[s].name();
+        r.particles = n;
+        r.threads = counts[c];
+        r.steps = steps;
+        r.ms = ms;
+        bool pairs = solvers[s].kind == SweepSolver::DIRECT;
+        r.nsPerInteraction = pairs ? ms * 1e6 / (double(n) * n) : NAN;
+        r.stepsPerSecond = 1000 / ms;
+        r.memoryMB = max(0.0, heapMB() - heap);  // while stepper still holds it
+        r.error = error.median;
+        r.momentum = moving > 0 ? p.mag() / moving : 0;
+        double change = fabs(end.total() - start.total());
+        r.drift = change / fabs(start.total());
+        r.balance = end.kinetic > 0 ? change / end.kinetic : 0;
+        r.sampled = n > exact;
+        // a sampled potential is only good to a few percent
+        double balance = solvers[s].balance + (r.sampled ? 0.1 : 0);
+        r.ok = r.error <= solvers[s].error &&
+               r.momentum <= solvers[s].momentum && r.balance <= balance;
+        char ns[16] = "-";
+        if (pairs) snprintf(ns, sizeof(ns), "%.3g", r.nsPerInteraction);
+        printf("%-16s %9zu %7d %10.3f %9s %10.1f %6.1f %9.2e %9.2e %9.2e "
+               "%9.2e %4s\n",
+               r.solver.c_str(), n, r.threads, r.ms, ns, r.stepsPerSecond,
+               r.memoryMB, r.error, r.momentum, r.drift, r.balance,
+               r.ok ? "yes" : "NO");
+        runs.push_back(r);
+      }
+    }
+  }
+
+  ofstream csv(prefix + ".csv");
+  csv << "solver,step,particles,threads,steps,ms_per_step,ns_per_interaction,"
+         "steps_per_second,memory_mb,force_error,momentum,energy_drift,"
+         "energy_balance,"
+         "energy_sampled,ok\n";
+  for (auto& r : runs)
+    csv << r.solver << ",kdk," << r.particles << "," << r.threads << ","
+        << r.steps << "," << r.ms << ","
+        << orNone(r.nsPerInteraction, "") << ","
+        << r.stepsPerSecond << "," << r.memoryMB << "," << r.error << ","
+        << r.momentum << ","
+        << r.drift << "," << r.balance << "," << r.sampled << "," << r.ok
+        << "\n";
+
+  ofstream json(prefix + ".json");
+  json << "{\n  \"cores\": " << thread::hardware_concurrency()
+       << ",\n  \"kernel\": \"" << kernelName(bestKernel())
+       << "\",\n  \"step\": \"kdk\",\n  \"seed\": 1,\n  \"dt\": " << dt
+       << ",\n  \"charge\": " << charge << ",\n  \"runs\": [\n";
+  for (size_t k = 0; k < runs.size(); k++) {
+    auto& r = runs[k];
+    json << "    {\"solver\": \"" << r.solver
+         << "\", \"particles\": " << r.particles
+         << ", \"threads\": " << r.threads << ", \"steps\": " << r.steps
+         << ", \"msPerStep\": " << r.ms
+         << ", \"nsPerInteraction\": "
+         << orNone(r.nsPerInteraction, "null")
+         << ", \"stepsPerSecond\": " << r.stepsPerSecond
+         << ", \"memoryMB\": " << r.memoryMB
+         << ", \"forceError\": " << r.error
+         << ", \"momentum\": " << r.momentum
+         << ", \"energyDrift\": " << r.drift
+         << ", \"energyBalance\": " << r.balance
+         << ", \"energySampled\": " << (r.sampled ? "true" : "false")
+         << ", \"ok\": " << (r.ok ? "true" : "false") << "}"
+         << (k + 1 < runs.size() ? "," : "") << "\n";
+  }
+  json << "  ]\n}\n";
+  printf("wrote %s.csv and %s.json (%zu runs)\n", prefix.c_str(),
+         prefix.c_str(), runs.size());
+
+  for (auto& r : runs)
+    if (!r.ok) return false;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1 && strcmp(argv[1], "sweep") == 0) {
+    string prefix = argc > 2 ? argv[2] : "nbody-sweep";
+    size_t most = argc > 3 ? atol(argv[3]) : 1000000;
+    double limitMs = argc > 4 ? atof(argv[4]) : 2000;
+    return sweep(prefix, most, limitMs) ? 0 : 1;
+  }
+  size_t n = argc > 1 ? atoi(argv[1]) : 16384;
+  threads(n);
+  integrators();
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+// what the particle apps' faster gravity solvers all compute, how far one
+// of them is from it, and the energy it conserves.
+//
+// every particle has unit charge (mass is only inertia, as in the apps'
+// integration) and is pulled toward every other by G / r^2, softened so two
+// particles passing through each other don't fling apart:
+//
+//   f_i = G * sum_j (x_j - x_i) / (|x_j - x_i|^2 + e^2)^(3/2)
+//
+// with e = 0 that is the equal-and-opposite pair sum the apps' pairForces()
+// loops set out to compute (theirs fold the running total of particle i,
+// not just the pair's force, into particle j). the solvers add f_i into the
+// apps' acceleration arrays, which the integration divides by mass.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+
+// the exact force on a particle at p (any particle there contributes nothing)
+inline al::Vec3f directForce(const std::vector<al::Vec3f>& positions,
+                             const al::Vec3f& p, float G, float softening) {
+  double e2 = double(softening) * softening;
+  double fx = 0, fy = 0, fz = 0;
+  for (auto& q : positions) {
+    double dx = q.x - p.x, dy = q.y - p.y, dz = q.z - p.z;
+    double r2 = dx * dx + dy * dy + dz * dz + e2;
+    if (r2 <= 0) continue;
+    double inv = 1 / std::sqrt(r2);
+    double inv3 = inv * inv * inv;
+    fx += dx * inv3;
+    fy += dy * inv3;
+    fz += dz * inv3;
+  }
+  return al::Vec3f(fx * G, fy * G, fz * G);
+}
+
+// |approximate - exact| / |exact| over a sample of the particles
+struct ForceError {
+  double median = 0, p99 = 0, max = 0, rms = 0;
+  int samples = 0;
+};
+
+// approx(i) is a solver's force on particle i; samples particles spread
+// evenly through the array are checked against directForce()
+template <typename Approx>
+ForceError measureForceError(const std::vector<al::Vec3f>& positions, float G,
+                             float softening, int samples, Approx approx) {
+  ForceError e;
+  size_t n = positions.size();
+  if (n == 0 || samples <= 0) return e;
+  size_t stride = std::max<size_t>(1, n / samples);
+  std::vector<double> errors;
+  for (size_t i = 0; i < n && errors.size() < size_t(samples); i += stride) {
+    al::Vec3f exact = directForce(positions, positions[i], G, softening);
+    al::Vec3f a = approx(i);
+    double magnitude = exact.mag();
+    if (magnitude == 0) continue;
+    errors.push_back((a - exact).mag() / magnitude);
+  }
+  if (errors.empty()) return e;
+  std::sort(errors.begin(), errors.end());
+  e.samples = errors.size();
+  e.median = errors[errors.size() / 2];
+  e.p99 = errors[std::min(errors.size() - 1, size_t(errors.size() * 0.99))];
+  e.max = errors.back();
+  for (double x : errors) e.rms += x * x;
+  e.rms = std::sqrt(e.rms / errors.size());
+  return e;
+}
+
+// the energy those forces conserve (without the apps' drag and clamp):
+// 1/2 m v^2 each, and -G / sqrt(r^2 + e^2) for every pair. the potential is
+// every pair, in double, so it is for checks on a few thousand particles
+struct Energy {
+  double kinetic = 0, potential = 0;
+  double total() const { return kinetic + potential; }
+};
+
+inline Energy energy(const std::vector<al::Vec3f>& positions,
+                     const std::vector<al::Vec3f>& velocities,
+                     const std::vector<float>& masses, float G,
+                     float softening) {
+  Energy e;
+  double e2 = double(softening) * softening;
+  size_t n = positions.size();
+  for (size_t i = 0; i < n; i++) {
+    e.kinetic += 0.5 * masses[i] * velocities[i].magSqr();
+    double sum = 0;
+    for (size_t j = i + 1; j < n; j++) {
+      double dx = positions[j].x - positions[i].x,
+             dy = positions[j].y - positions[i].y,
+             dz = positions[j].z - positions[i].z;
+      double r2 = dx * dx + dy * dy + dz * dz + e2;
+      if (r2 > 0) sum += 1 / std::sqrt(r2);
+    }
+    e.potential -= G * sum;
+  }
+  return e;
+}
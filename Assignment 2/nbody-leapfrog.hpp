@@ -0,0 +1,135 @@
+#pragma once
+
+// kick-drift-kick leapfrog with individual block timesteps, for the
+// particle apps' gravity.
+//
+// a step of dt is cut into 2^levels of the shortest substep, and every
+// particle is on a rung: rung r steps dt / 2^r at a time. a particle's step
+// is a half kick (v += a h/2), drifts (x += v, every substep, like everyone
+// else), and a half kick with the force at the new positions; only the
+// particles whose step ends on a substep have their force evaluated there.
+// after that closing kick a particle takes the rung its acceleration asks
+// for,
+//
+//   h <= sqrt(2 eta softening / |a|)
+//
+// so it moves to shorter steps as it falls into a close encounter and back
+// out after. it may go down a rung (longer steps) only where the longer
+// step's boundary falls, keeping the steps nested: the blocks stay in
+// lockstep and every particle is back in sync at the end of dt.
+//
+// unlike the apps' semi-implicit Euler this is time-symmetric, so with the
+// softened force of nbody-forces.hpp the energy doesn't drift away, and
+// particles far from everything take big steps while the few in close
+// encounters take small ones.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+
+class BlockLeapfrog {
+ public:
+  int levels = 6;      // the shortest step is dt / 2^levels
+  float eta = 0.005f;  // accuracy; smaller takes shorter steps
+
+  // force evaluations (one particle's force, once) and simulated time
+  // since the start, to compare with one evaluation per particle per step
+  uint64_t evaluations = 0;
+  double simulated = 0;
+
+  // the positions, velocities or forces changed outside step(): every
+  // acceleration is evaluated again at the next, and the counts start over
+  void reset() {
+    acceleration.clear();
+    evaluations = 0;
+    simulated = 0;
+  }
+
+  // advances everything by dt. forces(active, force) adds the force on each
+  // particle listed in active to force[i] (the mass is only inertia)
+  template <typename Forces>
+  void step(std::vector<al::Vec3f>& position, std::vector<al::Vec3f>& velocity,
+            const std::vector<float>& mass, float dt, float softening,
+            Forces forces) {
+    size_t n = position.size();
+    int substeps = 1 << levels;
+    float tiny = dt / substeps;
+
+    if (acceleration.size() != n || rung.size() != n) {
+      // starting out: everyone's force, and their first rungs
+      acceleration.assign(n, al::Vec3f(0, 0, 0));
+      rung.assign(n, 0);
+      active.resize(n);
+      for (size_t i = 0; i < n; i++) active[i] = i;
+      evaluate(mass, forces);
+      for (size_t i = 0; i < n; i++) rung[i] = wanted(i, dt, softening);
+    }
+
+    for (int s = 0; s < substeps;) {
+      // up to the next substep where any step ends
+      int finest = 0;
+      for (uint8_t r : rung) finest = std::max<int>(finest, r);
+      int stride = substeps >> finest;
+
+      // opening half kicks, for the steps that start here
+      for (size_t i = 0; i < n; i++)
+        if (s % period(i) == 0)
+          velocity[i] += acceleration[i] * (tiny * period(i) / 2);
+
+      for (size_t i = 0; i < n; i++)
+        position[i] += velocity[i] * (tiny * stride);
+      s += stride;
+
+      // closing half kicks, for the steps that end here
+      active.clear();
+      for (size_t i = 0; i < n; i++)
+        if (s % period(i) == 0) active.push_back(i);
+      evaluate(mass, forces);
+      for (uint32_t i : active) {
+        velocity[i] += acceleration[i] * (tiny * period(i) / 2);
+        int r = wanted(i, dt, softening);
+        if (r > rung[i])
+          rung[i] = r;  // shorter steps right away
+        else if (r < rung[i] && s % (2 * period(i)) == 0)
+          rung[i]--;  // longer ones a rung at a time, when in step
+      }
+    }
+    simulated += dt;
+  }
+
+  // how many particles are on each rung
+  std::vector<size_t> occupancy() const {
+    std::vector<size_t> count(levels + 1, 0);
+    for (uint8_t r : rung) count[std::min<int>(r, levels)]++;
+    return count;
+  }
+
+ private:
+  int period(size_t i) const { return (1 << levels) >> rung[i]; }
+
+  // the rung the acceleration criterion asks for
+  int wanted(size_t i, float dt, float softening) const {
+    float a = acceleration[i].mag();
+    if (a <= 0) return 0;
+    float h = std::sqrt(2 * eta * std::max(softening, 1e-6f) / a);
+    int r = 0;
+    while (r < levels && dt / (1 << r) > h) r++;
+    return r;
+  }
+
+  template <typename Forces>
+  void evaluate(const std::vector<float>& mass, Forces& forces) {
+    if (active.empty()) return;
+    for (uint32_t i : active) acceleration[i].zero();
+    forces(active, acceleration);
+    for (uint32_t i : active) acceleration[i] /= mass[i];
+    evaluations += active.size();
+  }
+
+  std::vector<al::Vec3f> acceleration;  // at each particle's last kick
+  std::vector<uint8_t> rung;
+  std::vector<uint32_t> active;  // whose force is being evaluated
+};
@@ -0,0 +1,267 @@
+#pragma once
+
+// Barnes-Hut gravity: the particles are put in an octree each step, and a
+// particle feels a far-away cell as one charge at the cell's center of
+// charge. a cell is far enough away when its size over its distance is less
+// than theta; theta = 0 opens every cell (the exact sum, slowly), 0.5-0.7 is
+// the usual trade, larger is faster and rougher. see measureForceError() in
+// nbody-forces.hpp for how rough.
+//
+// the tree is built by sorting the particles along a Morton (z-order) curve,
+// so every cell is a contiguous run of them, and stored depth first with a
+// skip index per cell: walking it is a loop over one array, no stack and no
+// pointers. the tree is walked once per group of up to groupSize neighbouring
+// particles rather than once per particle: a cell is far enough away if it
+// is from the nearest point of the group's bounding box, and the group's
+// particles then all sum the same list of charges with the SIMD kernel of
+// nbody-kernel.hpp instead of chasing pointers one by one. the groups are
+// independent and share the pool's threads.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+
+#include "../common/thread-pool.hpp"
+#include "nbody-forces.hpp"
+#include "nbody-kernel.hpp"
+
+class Octree {
+ public:
+  int leafSize = 8;    // particles a cell can hold before it is split
+  int groupSize = 32;  // particles that share a walk
+  ForceKernel kernel = bestKernel();
+
+  void build(const std::vector<al::Vec3f>& positions) {
+    size_t n = positions.size();
+    nodes.clear();
+    groups.clear();
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    order.resize(n);
+    keys.resize(n);
+    if (n == 0) return;
+
+    // the bounding cube, divided into 2^21 steps a side
+    al::Vec3f lo = positions[0], hi = positions[0];
+    for (auto& p : positions)
+      for (int k = 0; k < 3; k++) {
+        lo[k] = std::min(lo[k], p[k]);
+        hi[k] = std::max(hi[k], p[k]);
+      }
+    float side = std::max({hi.x - lo.x, hi.y - lo.y, hi.z - lo.z});
+    side = side > 0 ? side * 1.0001f : 1;
+    float steps = float(1 << BITS) / side;
+
+    std::vector<std::pair<uint64_t, uint32_t>> sorted(n);
+    for (size_t i = 0; i < n; i++) {
+      uint32_t cx = cell((positions[i].x - lo.x) * steps);
+      uint32_t cy = cell((positions[i].y - lo.y) * steps);
+      uint32_t cz = cell((positions[i].z - lo.z) * steps);
+      sorted[i] = {spread(cx) | spread(cy) << 1 | spread(cz) << 2, uint32_t(i)};
+    }
+    std::sort(sorted.begin(), sorted.end());
+    computed.assign(n, al::Vec3f(0, 0, 0));
+    rank.resize(n);
+    for (size_t k = 0; k < n; k++) {
+      keys[k] = sorted[k].first;
+      order[k] = sorted[k].second;
+      rank[order[k]] = k;
+      x[k] = positions[order[k]].x;
+      y[k] = positions[order[k]].y;
+      z[k] = positions[order[k]].z;
+    }
+
+    nodes.reserve(2 * n / leafSize + 64);
+    add(0, n, 0, side, false);
+  }
+
+  // adds every particle's force to forces[i]
+  void accumulate(float G, float theta, float softening,
+                  std::vector<al::Vec3f>& forces, ThreadPool& pool) {
+    float theta2 = theta * theta, e2 = softening * softening;
+    pool.parallelFor(groups.size(), [&](size_t begin, size_t end) {
+      Charges list;
+      std::vector<float> f;
+      for (size_t g = begin; g < end; g++) {
+        walk(groups[g], theta2, list);
+        sum(groups[g], list, G, e2, f);
+      }
+    });
+    for (size_t k = 0; k < order.size(); k++) forces[order[k]] += computed[k];
+  }
+
+  // the force the last accumulate() gave particle i
+  al::Vec3f force(size_t i) const { return computed[rank[i]]; }
+
+  size_t cells() const { return nodes.size(); }
+
+ private:
+  enum { BITS = 21 };  // per axis, 63 in a key
+
+  struct Node {
+    float x, y, z;   // center of charge
+    float charge;    // particles in the cell
+    float size2;     // side length, squared
+    uint32_t next;   // the first node after this cell's subtree
+    uint32_t first;  // its particles, in curve order
+    uint32_t last;
+  };
+
+  struct Group {
+    uint32_t first, last;
+    al::Vec3f lo, hi;  // bounding box
+  };
+
+  // what a group's walk found, as separate arrays for the sum
+  struct Charges {
+    std::vector<float> x, y, z, charge;
+    void clear() {
+      x.clear();
+      y.clear();
+      z.clear();
+      charge.clear();
+    }
+    void push(float px, float py, float pz, float c) {
+      x.push_back(px);
+      y.push_back(py);
+      z.push_back(pz);
+      charge.push_back(c);
+    }
+  };
+
+  static uint32_t cell(float f) {
+    return uint32_t(std::min(std::max(f, 0.0f), float((1 << BITS) - 1)));
+  }
+
+  // 21 bits to every third of 63
+  static uint64_t spread(uint32_t v) {
+    uint64_t x = v & 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffull;
+    x = (x | x << 16) & 0x1f0000ff0000ffull;
+    x = (x | x << 8) & 0x100f00f00f00f00full;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+  }
+
+  // the cell holding particles [first, last), whose keys agree above level
+  // (levels count down from the root's three top bits). the largest cells
+  // of no more than groupSize are the groups
+  void add(uint32_t first, uint32_t last, int level, float side,
+           bool inGroup) {
+    if (!inGroup && last - first <= uint32_t(groupSize)) {
+      inGroup = true;
+      Group g{first, last, {x[first], y[first], z[first]}, {}};
+      g.hi = g.lo;
+      for (uint32_t k = first; k < last; k++) {
+        al::Vec3f p(x[k], y[k], z[k]);
+        for (int a = 0; a < 3; a++) {
+          g.lo[a] = std::min(g.lo[a], p[a]);
+          g.hi[a] = std::max(g.hi[a], p[a]);
+        }
+      }
+      groups.push_back(g);
+    }
+    uint32_t self = nodes.size();
+    nodes.push_back({0, 0, 0, 0, side * side, 0, first, last});
+    double cx = 0, cy = 0, cz = 0, charge = 0;
+    if (last - first <= uint32_t(leafSize) || level == BITS) {
+      for (uint32_t k = first; k < last; k++) {
+        cx += x[k];
+        cy += y[k];
+        cz += z[k];
+      }
+      charge = last - first;
+    } else {
+      // the eight children are the runs with each value of the next 3 bits
+      int shift = 3 * (BITS - 1 - level);
+      uint64_t prefix = keys[first] >> (shift + 3) << (shift + 3);
+      uint32_t begin = first;
+      for (int c = 0; c < 8 && begin < last; c++) {
+        uint32_t end = last;
+        if (c < 7)
+          end = std::lower_bound(keys.begin() + begin, keys.begin() + last,
+                                 prefix | uint64_t(c + 1) << shift) -
+                keys.begin();
+        if (end == begin) continue;
+        uint32_t child = nodes.size();
+        add(begin, end, level + 1, side / 2, inGroup);
+        const Node& n = nodes[child];
+        cx += double(n.x) * n.charge;
+        cy += double(n.y) * n.charge;
+        cz += double(n.z) * n.charge;
+        charge += n.charge;
+        begin = end;
+      }
+    }
+    Node& n = nodes[self];
+    n.x = cx / charge;
+    n.y = cy / charge;
+    n.z = cz / charge;
+    n.charge = charge;
+    n.next = nodes.size();
+  }
+
+  // the charges group g feels: whole cells that are far enough from all of
+  // its particles, and the particles of the leaves that aren't
+  void walk(const Group& g, float theta2, Charges& list) const {
+    list.clear();
+    uint32_t i = 0, count = nodes.size();
+    while (i < count) {
+      const Node& n = nodes[i];
+      if (n.next == i + 1) {
+        for (uint32_t k = n.first; k < n.last; k++)
+          list.push(x[k], y[k], z[k], 1);
+        i = n.next;
+        continue;
+      }
+      // from the center of charge to the nearest point of the group's box
+      float dx = std::max({g.lo.x - n.x, 0.0f, n.x - g.hi.x});
+      float dy = std::max({g.lo.y - n.y, 0.0f, n.y - g.hi.y});
+      float dz = std::max({g.lo.z - n.z, 0.0f, n.z - g.hi.z});
+      if (n.size2 < theta2 * (dx * dx + dy * dy + dz * dz)) {
+        list.push(n.x, n.y, n.z, n.charge);  // far enough: the whole cell
+        i = n.next;
+      } else {
+        i++;  // open it: its first child is next
+      }
+    }
+  }
+
+  // the group's particles against the list; f is room for their forces
+  void sum(const Group& g, const Charges& list, float G, float e2,
+           std::vector<float>& f) {
+    size_t n = g.last - g.first;
+    f.assign(3 * n, 0);
+    ForceBatch b;
+    b.tx = x.data() + g.first;
+    b.ty = y.data() + g.first;
+    b.tz = z.data() + g.first;
+    b.n = n;
+    b.sx = list.x.data();
+    b.sy = list.y.data();
+    b.sz = list.z.data();
+    b.charge = list.charge.data();
+    b.m = list.x.size();
+    b.e2 = e2;
+    b.fx = f.data();
+    b.fy = f.data() + n;
+    b.fz = f.data() + 2 * n;
+    sumForces(kernel, b);
+    for (size_t k = 0; k < n; k++)
+      computed[g.first + k] = al::Vec3f(b.fx[k], b.fy[k], b.fz[k]) * G;
+  }
+
+  std::vector<Node> nodes;
+  std::vector<float> x, y, z;    // positions in curve order
+  std::vector<uint32_t> order;   // which particle each is
+  std::vector<uint32_t> rank;    // where each particle is in that order
+  std::vector<uint64_t> keys;
+  std::vector<Group> groups;
+  std::vector<al::Vec3f> computed;  // forces, in curve order
+};
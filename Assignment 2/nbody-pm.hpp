@@ -0,0 +1,437 @@
+#pragma once
+
+// particle-mesh gravity: the particles' charge is spread onto a grid, the
+// potential comes from one FFT convolution with 1/r and the force from its
+// gradient, read back at every particle. the cost is the grid's (fixed) plus
+// two passes over the particles, so it grows linearly with their number; the
+// price is resolution, the force being smooth on the scale of a grid cell
+// and so a field for many bodies (galaxies, not binaries).
+//
+// every step the grid (size^3 cells) is fitted around the particles, or
+// around most of them: one far away would otherwise stretch the cells until
+// the rest share a handful. the box reaches a quarter of the span between
+// the 1st and 99th percentiles (per axis, from a sample) past them; anyone
+// beyond that, or not at a finite place, is an outlier and left off the grid:
+//  - outliers: each feels the grid's particles as one charge at their
+//    center, and they all feel it back as the same pull on that center.
+//    outliers feel each other directly, when there are few enough.
+//  - deposit: each particle's unit charge is shared between the 8 nearest
+//    cell centers ("cloud in cell"). the particles are bucketed by plane
+//    first, and each plane of the grid is then summed by one thread from the
+//    two buckets that reach it, in particle order: no locks, no per-thread
+//    copies of the grid, and the same sums on any number of threads.
+//  - solve: the grid is zero-padded to twice its size a side so the FFT's
+//    wrap-around can't reach a real cell (isolated, not periodic, space),
+//    transformed, multiplied by the transform of -1/r (softened by a cell
+//    and by the softening asked for, in quadrature; computed again only
+//    when that changes by 5%), and transformed back. the 3D FFTs are 1D
+//    FFTs along every line of the grid, shared between the threads,
+//    skipping the lines that are known to be zero (or not needed).
+//  - gradient: central differences, then the same cloud-in-cell weights
+//    interpolate the force back to the particles.
+//
+// with the potential's sign the forces are the attraction of
+// nbody-forces.hpp: f_i = G sum_j (x_j - x_i) / r^3 at distances over a few
+// cells.
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+
+#include "../common/thread-pool.hpp"
+
+// radix-2 complex FFT of a fixed power-of-two size, in place
+class Fft {
+ public:
+  void resize(int n) {
+    if (n == size) return;
+    size = n;
+    twiddles.resize(n / 2);
+    for (int k = 0; k < n / 2; k++)
+      twiddles[k] = std::polar(1.0, -2 * M_PI * k / n);
+    reversed.resize(n);
+    int bits = 0;
+    while ((1 << bits) < n) bits++;
+    for (int i = 0; i < n; i++) {
+      int r = 0;
+      for (int b = 0; b < bits; b++) r |= ((i >> b) & 1) << (bits - 1 - b);
+      reversed[i] = r;
+    }
+  }
+
+  // unnormalized both ways: inverse(forward(a)) is size * a
+  void transform(std::complex<float>* a, bool inverse) const {
+    for (int i = 0; i < size; i++)
+      if (i < reversed[i]) std::swap(a[i], a[reversed[i]]);
+    for (int half = 1; half < size; half *= 2) {
+      int step = size / (2 * half);
+      for (int start = 0; start < size; start += 2 * half)
+        for (int k = 0; k < half; k++) {
+          // by hand: std::complex's operator* checks for infinities
+          float wr = twiddles[k * step].real(),
+                wi = inverse ? -twiddles[k * step].imag()
+                             : twiddles[k * step].imag();
+          std::complex<float> u = a[start + k], b = a[start + k + half];
+          std::complex<float> v(b.real() * wr - b.imag() * wi,
+                                b.real() * wi + b.imag() * wr);
+          a[start + k] = u + v;
+          a[start + k + half] = u - v;
+        }
+    }
+  }
+
+ private:
+  int size = 0;
+  std::vector<std::complex<float>> twiddles;
+  std::vector<int> reversed;
+};
+
+class ParticleMesh {
+ public:
+  int size = 64;  // cells a side (a power of two)
+
+  // adds every particle's force to forces[i]
+  void accumulate(const std::vector<al::Vec3f>& positions, float G,
+                  float softening, std::vector<al::Vec3f>& forces,
+                  ThreadPool& pool) {
+    size_t n = positions.size();
+    computed.assign(n, al::Vec3f(0, 0, 0));
+    if (n == 0) return;
+    fit(positions);
+    prepare(softening, pool);
+    deposit(positions, pool);
+    solve(G, pool);
+    gradient(pool);
+    interpolate(pool);
+    outside(positions, G, softening);
+    for (size_t i = 0; i < n; i++) forces[i] += computed[i];
+  }
+
+  // the force the last accumulate() gave particle i
+  al::Vec3f force(size_t i) const { return computed[i]; }
+
+  float cell() const { return h; }
+  // particles the last accumulate() left off the grid
+  size_t outlierCount() const { return outliers.size(); }
+
+ private:
+  typedef std::complex<float> Complex;
+  enum { WIDTH = 8 };  // complex floats a cache line
+  enum { SAMPLES = 4096 };  // positions fit() takes the percentiles of
+  enum { PAIRED = 256 };  // outliers that feel each other directly, at most
+  enum : uint32_t { OFF = 0xffffffff };  // a cloud that isn't on the grid
+
+  // a particle's 8 cells (their low corner) and its weights toward the
+  // higher of each pair
+  struct Cloud {
+    uint32_t c[3];
+    float f[3];
+  };
+
+  // the padded grid is P = 2 * size a side, the real one M = size
+  size_t P() const { return 2 * size; }
+  size_t M() const { return size; }
+  size_t at(size_t x, size_t y, size_t z, size_t side) const {
+    return (z * side + y) * side + x;
+  }
+
+  // sizes the grids and, once per size and softening, transforms the
+  // Green's function
+  void prepare(float softening, ThreadPool& pool) {
+    float e2 = 1 + softening * softening / (h * h);  // cells, squared
+    if (greenSize == size && std::fabs(e2 - greenSoftening) <= 0.05f * e2)
+      return;
+    greenSize = size;
+    greenSoftening = e2;
+    size_t p = P();
+    fft.resize(p);
+    padded.assign(p * p * p, 0);
+    for (size_t z = 0; z < p; z++)
+      for (size_t y = 0; y < p; y++)
+        for (size_t x = 0; x < p; x++) {
+          // distances in cells, wrapped: the padded grid is a torus
+          float dx = std::min(x, p - x), dy = std::min(y, p - y),
+                dz = std::min(z, p - z);
+          padded[at(x, y, z, p)] =
+              -1 / std::sqrt(dx * dx + dy * dy + dz * dz + e2);
+        }
+    transform(false, p, p, pool);
+    // -1/r is real and even, so is its transform; the inverse FFT's 1/P^3
+    // goes in here too
+    green.resize(padded.size());
+    float scale = 1.0f / (p * p * p);
+    for (size_t i = 0; i < padded.size(); i++)
+      green[i] = padded[i].real() * scale;
+    size_t m = M();
+    density.assign(m * m * m, 0);
+    potential.assign(m * m * m, 0);
+    for (auto& g : field) g.assign(m * m * m, 0);
+  }
+
+  // the grid's cube around the particles (see the top), two cells in from
+  // each face so the cloud-in-cell weights and the gradient stay inside it
+  void fit(const std::vector<al::Vec3f>& positions) {
+    size_t n = positions.size();
+    size_t stride = std::max<size_t>(1, n / SAMPLES);
+    al::Vec3f lo(0, 0, 0), hi(0, 0, 0);
+    for (int k = 0; k < 3; k++) {
+      sample.clear();
+      for (size_t i = 0; i < n; i += stride)
+        if (std::isfinite(positions[i][k])) sample.push_back(positions[i][k]);
+      if (sample.empty()) continue;
+      size_t tail = sample.size() / 100;
+      std::nth_element(sample.begin(), sample.begin() + tail, sample.end());
+      float low = sample[tail];
+      std::nth_element(sample.begin(), sample.end() - 1 - tail, sample.end());
+      float high = sample[sample.size() - 1 - tail];
+      lo[k] = low - (high - low) / 4;
+      hi[k] = high + (high - low) / 4;
+    }
+    // no bigger than the particles need
+    al::Vec3f least(hi), most(lo);
+    for (auto& p : positions)
+      for (int k = 0; k < 3; k++) {
+        if (!(p[k] >= lo[k] && p[k] <= hi[k])) continue;
+        least[k] = std::min(least[k], p[k]);
+        most[k] = std::max(most[k], p[k]);
+      }
+    for (int k = 0; k < 3; k++)
+      if (least[k] <= most[k]) {
+        lo[k] = least[k];
+        hi[k] = most[k];
+      }
+    float side = std::max({hi.x - lo.x, hi.y - lo.y, hi.z - lo.z});
+    h = std::max(side, 1e-6f) * 1.0001f / (size - 4);
+    origin = lo - al::Vec3f(2 * h, 2 * h, 2 * h);
+  }
+
+  void deposit(const std::vector<al::Vec3f>& positions, ThreadPool& pool) {
+    size_t m = M(), n = positions.size();
+    clouds.resize(n);
+    pool.parallelFor(n, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++)
+        for (int k = 0; k < 3; k++) {
+          float u = (positions[i][k] - origin[k]) / h - 0.5f;  // from centers
+          // off the grid, or not a number: an outlier. the cell and the
+          // one after it have to be inside the faces, where the field is
+          if (!(u >= 1 && u < m - 2)) {
+            clouds[i].c[0] = OFF;
+            break;
+          }
+          float cell = std::floor(u);
+          clouds[i].c[k] = uint32_t(cell);
+          clouds[i].f[k] = u - cell;
+        }
+    });
+
+    // counting sort by lower plane; the outliers, and the center of the rest
+    planeStart.assign(m + 1, 0);
+    outliers.clear();
+    double sum[3] = {0, 0, 0};
+    for (size_t i = 0; i < n; i++) {
+      if (clouds[i].c[0] == OFF) {
+        outliers.push_back(i);
+        continue;
+      }
+      planeStart[clouds[i].c[2] + 1]++;
+      for (int k = 0; k < 3; k++) sum[k] += positions[i][k];
+    }
+    size_t inside = n - outliers.size();
+    for (int k = 0; k < 3; k++) center[k] = inside ? sum[k] / inside : 0;
+    for (size_t z = 0; z < m; z++) planeStart[z + 1] += planeStart[z];
+    byPlane.resize(inside);
+    std::vector<uint32_t> next(planeStart.begin(), planeStart.end() - 1);
+    for (size_t i = 0; i < n; i++)
+      if (clouds[i].c[0] != OFF) byPlane[next[clouds[i].c[2]]++] = i;
+
+    pool.parallelFor(m, [&](size_t begin, size_t end) {
+      for (size_t z = begin; z < end; z++) {
+        float* plane = &density[at(0, 0, z, m)];
+        std::fill(plane, plane + m * m, 0.0f);
+        // the particles a plane below reach up into it, then its own
+        for (size_t own = 0; own < 2; own++) {
+          if (!own && z == 0) continue;
+          size_t from = z - 1 + own;
+          for (uint32_t k = planeStart[from]; k < planeStart[from + 1]; k++) {
+            const Cloud& cloud = clouds[byPlane[k]];
+            const float* f = cloud.f;
+            float wz = own ? 1 - f[2] : f[2];
+            for (int dy = 0; dy < 2; dy++) {
+              float wyz = wz * (dy ? f[1] : 1 - f[1]);
+              float* row = plane + (cloud.c[1] + dy) * m + cloud.c[0];
+              row[0] += wyz * (1 - f[0]);
+              row[1] += wyz * f[0];
+            }
+          }
+        }
+      }
+    });
+  }
+
+  void solve(float G, ThreadPool& pool) {
+    size_t p = P(), m = M();
+    // the density in one corner of the padded grid, zeros elsewhere
+    pool.parallelFor(p, [&](size_t begin, size_t end) {
+      for (size_t z = begin; z < end; z++)
+        for (size_t y = 0; y < p; y++)
+          for (size_t x = 0; x < p; x++)
+            padded[at(x, y, z, p)] =
+                x < m && y < m && z < m ? density[at(x, y, z, m)] : 0;
+    });
+    transform(false, m, m, pool);
+    pool.parallelFor(padded.size(), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) padded[i] *= green[i];
+    });
+    transform(true, m, m, pool);
+    // green is in cells; G / h makes it world units
+    float scale = G / h;
+    pool.parallelFor(m, [&](size_t begin, size_t end) {
+      for (size_t z = begin; z < end; z++)
+        for (size_t y = 0; y < m; y++)
+          for (size_t x = 0; x < m; x++)
+            potential[at(x, y, z, m)] = padded[at(x, y, z, p)].real() * scale;
+    });
+  }
+
+  // the 3D FFT of the padded grid. forward, only the first ny rows of the
+  // first nz planes hold anything before the x pass, and only the first nz
+  // planes before the y pass; inverse, the same rows and planes are all
+  // that's needed after. the lines in between are skipped
+  void transform(bool inverse, size_t ny, size_t nz, ThreadPool& pool) {
+    size_t p = P();
+    auto rows = [&]() {
+      pool.parallelFor(nz * ny, [&](size_t begin, size_t end) {
+        for (size_t l = begin; l < end; l++)
+          fft.transform(&padded[at(0, l % ny, l / ny, p)], inverse);
+      });
+    };
+    auto strided = [&](size_t stride, size_t planes, size_t planeStride) {
+      // WIDTH neighbouring lines at a time, so every cache line read is
+      // read whole
+      size_t blocks = p / WIDTH;
+      pool.parallelFor(planes * blocks, [&](size_t begin, size_t end) {
+        std::vector<Complex> lines(WIDTH * p);
+        for (size_t l = begin; l < end; l++) {
+          size_t first = l / blocks * planeStride + l % blocks * WIDTH;
+          for (size_t i = 0; i < p; i++)
+            for (size_t w = 0; w < WIDTH; w++)
+              lines[w * p + i] = padded[first + i * stride + w];
+          for (size_t w = 0; w < WIDTH; w++)
+            fft.transform(&lines[w * p], inverse);
+          for (size_t i = 0; i < p; i++)
+            for (size_t w = 0; w < WIDTH; w++)
+              padded[first + i * stride + w] = lines[w * p + i];
+        }
+      });
+    };
+    auto columns = [&]() { strided(p, nz, p * p); };  // along y, by z
+    auto depths = [&]() { strided(p * p, p, p); };    // along z, by y
+    if (!inverse) {
+      rows();
+      columns();
+      depths();
+    } else {
+      depths();
+      columns();
+      rows();
+    }
+  }
+
+  // force per unit charge at every cell, -grad potential
+  void gradient(ThreadPool& pool) {
+    size_t m = M();
+    float inv = -0.5f / h;
+    pool.parallelFor(m, [&](size_t begin, size_t end) {
+      for (size_t z = begin; z < end; z++)
+        for (size_t y = 0; y < m; y++)
+          for (size_t x = 0; x < m; x++) {
+            size_t i = at(x, y, z, m);
+            if (x == 0 || y == 0 || z == 0 || x == m - 1 || y == m - 1 ||
+                z == m - 1) {
+              field[0][i] = field[1][i] = field[2][i] = 0;  // never read
+              continue;
+            }
+            field[0][i] = (potential[i + 1] - potential[i - 1]) * inv;
+            field[1][i] = (potential[i + m] - potential[i - m]) * inv;
+            field[2][i] = (potential[i + m * m] - potential[i - m * m]) * inv;
+          }
+    });
+  }
+
+  void interpolate(ThreadPool& pool) {
+    size_t m = M();
+    pool.parallelFor(clouds.size(), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        if (clouds[i].c[0] == OFF) continue;  // outside() does it
+        const uint32_t* c = clouds[i].c;
+        const float* f = clouds[i].f;
+        al::Vec3f sum(0, 0, 0);
+        for (int dz = 0; dz < 2; dz++)
+          for (int dy = 0; dy < 2; dy++) {
+            float wyz = (dz ? f[2] : 1 - f[2]) * (dy ? f[1] : 1 - f[1]);
+            size_t row = at(c[0], c[1] + dy, c[2] + dz, m);
+            for (int k = 0; k < 3; k++)
+              sum[k] += wyz * ((1 - f[0]) * field[k][row] +
+                               f[0] * field[k][row + 1]);
+          }
+        computed[i] = sum;
+      }
+    });
+  }
+
+  // the outliers' forces, and theirs on the grid's particles (see the top).
+  // one at no finite place feels nothing and pulls nothing
+  void outside(const std::vector<al::Vec3f>& positions, float G,
+               float softening) {
+    if (outliers.empty()) return;
+    size_t inside = positions.size() - outliers.size();
+    float e2 = softening * softening;
+    auto finite = [&](uint32_t i) {
+      const al::Vec3f& p = positions[i];
+      return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+    };
+    al::Vec3f pull(0, 0, 0);  // on each of the grid's particles
+    for (uint32_t o : outliers) {
+      if (!finite(o)) continue;
+      al::Vec3f d = center - positions[o];
+      float r2 = d.magSqr() + e2;
+      float f = G / (r2 * std::sqrt(r2));
+      computed[o] += d * (f * inside);
+      pull -= d * f;
+    }
+    if (outliers.size() <= PAIRED)
+      for (size_t a = 0; a < outliers.size(); a++)
+        for (size_t b = a + 1; b < outliers.size(); b++) {
+          uint32_t i = outliers[a], j = outliers[b];
+          if (!finite(i) || !finite(j)) continue;
+          al::Vec3f d = positions[j] - positions[i];
+          float r2 = d.magSqr() + e2;
+          al::Vec3f f = d * (G / (r2 * std::sqrt(r2)));
+          computed[i] += f;
+          computed[j] -= f;
+        }
+    for (size_t i = 0; i < computed.size(); i++)
+      if (clouds[i].c[0] != OFF) computed[i] += pull;
+  }
+
+  Fft fft;
+  int greenSize = 0;
+  float greenSoftening = 0;     // what green was softened by, cells squared
+  std::vector<float> green;     // transform of -1/r, padded
+  std::vector<Complex> padded;  // the FFT's working grid
+  std::vector<float> density, potential;
+  std::vector<float> field[3];  // -grad potential
+  std::vector<Cloud> clouds;          // per particle
+  std::vector<uint32_t> planeStart;   // clouds by lower plane: where each
+  std::vector<uint32_t> byPlane;      // plane's run starts, and the runs
+  std::vector<al::Vec3f> computed;
+  std::vector<uint32_t> outliers;  // particles off the grid
+  std::vector<float> sample;       // fit()'s
+  al::Vec3f origin;
+  al::Vec3f center;  // of the grid's particles
+  float h = 1;  // cell size
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+// the particle apps' particles as a pool: room for a fixed number, made
+// once, so particles can be emitted and killed while the simulation runs
+// without anything being reallocated.
+//
+// the state stays where the apps keep it, a slot per particle in the mesh
+// (vertices are positions, plus colors and texture coordinates) and in the
+// velocity, acceleration and mass arrays; the pool keeps them all the same
+// length and in the same order. the live particles are always the first
+// size() slots, so every loop over them stays a loop over [0, n): killing
+// one moves the last particle into its slot (swap-remove) and emitting
+// appends.
+//
+// that moves particles around, so anything that has to name one particle
+// for longer holds a handle instead: handles come from a free list, and
+// index() says which slot a handle's particle is in now.
+//
+// fill() makes the first particles on every thread at once; each block of
+// them has its own generator seeded from its position, so the particles are
+// the same on any number of threads.
+//
+// the colors and texture coordinates go to the GPU, maybe from another
+// thread than the one stepping. the pool keeps a copy of them with room for
+// capacity() particles and notes which slots changed: after emits and kills
+// the stepping thread shareLooks() just those slots into it, and the drawing
+// thread takeLooks() them from it, for an upload of just those slots.
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "al/graphics/al_Mesh.hpp"
+#include "al/math/al_Random.hpp"
+#include "al/math/al_Vec.hpp"
+#include "al/types/al_Color.hpp"
+
+#include "../common/thread-pool.hpp"
+
+struct Particle {
+  al::Vec3f position, velocity, acceleration;
+  float mass = 1;
+  al::Color color;
+  al::Vec2f texCoord;
+};
+
+class ParticlePool {
+ public:
+  enum : uint32_t { NONE = 0xffffffff };  // no handle, or no slot
+
+  // the colors and texture coordinates, in slot order, room for capacity()
+  // of each; the slots [from, to) changed since they were last taken
+  struct Looks {
+    std::vector<al::Color> colors;
+    std::vector<al::Vec2f> texCoords;
+    size_t from = 0, to = 0;
+  };
+
+  ParticlePool(al::Mesh& mesh, std::vector<al::Vec3f>& velocity,
+               std::vector<al::Vec3f>& acceleration, std::vector<float>& mass)
+      : mesh(mesh), velocity(velocity), acceleration(acceleration),
+        mass(mass) {}
+
+  // room for capacity particles, all allocated now; empties the pool
+  void reserve(size_t capacity) {
+    clear();
+    mesh.vertices().reserve(capacity);
+    mesh.colors().reserve(capacity);
+    mesh.texCoord2s().reserve(capacity);
+    velocity.reserve(capacity);
+    acceleration.reserve(capacity);
+    mass.reserve(capacity);
+    slotOf.assign(capacity, NONE);
+    handleAt.reserve(capacity);
+    unused.resize(capacity);
+    for (size_t k = 0; k < capacity; k++) unused[k] = capacity - 1 - k;
+    room = capacity;
+    std::lock_guard<std::mutex> lock(sharing);
+    shared.colors.resize(capacity);
+    shared.texCoords.resize(capacity);
+  }
+
+  size_t size() const { return handleAt.size(); }
+  size_t capacity() const { return room; }
+
+  // appends p; its handle, or NONE if the pool is full
+  uint32_t emit(const Particle& p) {
+    if (unused.empty()) return NONE;
+    uint32_t handle = unused.back();
+    unused.pop_back();
+    slotOf[handle] = handleAt.size();
+    handleAt.push_back(handle);
+    mesh.vertices().push_back(p.position);
+    mesh.colors().push_back(p.color);
+    mesh.texCoord2s().push_back(p.texCoord);
+    velocity.push_back(p.velocity);
+    acceleration.push_back(p.acceleration);
+    mass.push_back(p.mass);
+    touch(size() - 1, size());
+    changes++;
+    return handle;
+  }
+
+  // the particle in slot i goes; the last one takes its place
+  void killAt(size_t i) {
+    size_t last = size() - 1;
+    uint32_t dead = handleAt[i];
+    if (i != last) {
+      mesh.vertices()[i] = mesh.vertices()[last];
+      mesh.colors()[i] = mesh.colors()[last];
+      mesh.texCoord2s()[i] = mesh.texCoord2s()[last];
+      velocity[i] = velocity[last];
+      acceleration[i] = acceleration[last];
+      mass[i] = mass[last];
+      handleAt[i] = handleAt[last];
+      slotOf[handleAt[i]] = i;
+      touch(i, i + 1);
+    }
+    slotOf[dead] = NONE;
+    unused.push_back(dead);
+    pop();
+    changes++;
+  }
+
+  void kill(uint32_t handle) {
+    if (alive(handle)) killAt(slotOf[handle]);
+  }
+
+  bool alive(uint32_t handle) const {
+    return handle < slotOf.size() && slotOf[handle] != NONE;
+  }
+  size_t index(uint32_t handle) const { return slotOf[handle]; }
+  uint32_t handle(size_t i) const { return handleAt[i]; }
+
+  // replaces everything with count particles (no more than the capacity),
+  // make(i, random) making particle i, in parallel
+  template <typename Make>
+  void fill(size_t count, Make make, ThreadPool& pool, unsigned seed = 1) {
+    count = std::min(count, room);
+    size_t capacity = room;
+    reserve(capacity);  // empty, every handle free, nothing reallocated
+    mesh.vertices().resize(count);
+    mesh.colors().resize(count);
+    mesh.texCoord2s().resize(count);
+    velocity.resize(count);
+    acceleration.resize(count);
+    mass.resize(count);
+    handleAt.resize(count);
+    unused.resize(capacity - count);  // handles [0, count) are taken
+    size_t blocks = (count + BLOCK - 1) / BLOCK;
+    pool.parallelFor(blocks, [&](size_t begin, size_t end) {
+      for (size_t b = begin; b < end; b++) {
+        al::rnd::Random<> random(seed + b);
+        for (size_t i = b * BLOCK; i < std::min(count, (b + 1) * BLOCK); i++) {
+          Particle p = make(i, random);
+          mesh.vertices()[i] = p.position;
+          mesh.colors()[i] = p.color;
+          mesh.texCoord2s()[i] = p.texCoord;
+          velocity[i] = p.velocity;
+          acceleration[i] = p.acceleration;
+          mass[i] = p.mass;
+          handleAt[i] = i;
+          slotOf[i] = i;
+        }
+      }
+    });
+    touch(0, count);
+    changes++;
+  }
+
+  // which particle is where: a number that changes with every emit and kill
+  uint64_t layout() const { return changes; }
+
+  // stepping thread, after emits and kills: the slots whose looks changed
+  // are copied to where the drawing thread takes them from
+  void shareLooks() {
+    size_t to = std::min(dirtyTo, size());
+    if (dirtyFrom < to) {
+      std::lock_guard<std::mutex> lock(sharing);
+      std::copy(mesh.colors().begin() + dirtyFrom, mesh.colors().begin() + to,
+                shared.colors.begin() + dirtyFrom);
+      std::copy(mesh.texCoord2s().begin() + dirtyFrom,
+                mesh.texCoord2s().begin() + to,
+                shared.texCoords.begin() + dirtyFrom);
+      if (shared.from >= shared.to) {
+        shared.from = dirtyFrom;
+        shared.to = to;
+      } else {
+        shared.from = std::min(shared.from, dirtyFrom);
+        shared.to = std::max(shared.to, to);
+      }
+    }
+    dirtyFrom = dirtyTo = 0;
+  }
+
+  // drawing thread: show(looks) if any slots changed since the last time,
+  // then they count as shown. false if there was nothing to show
+  template <typename Show>
+  bool takeLooks(Show show) {
+    std::lock_guard<std::mutex> lock(sharing);
+    if (shared.from >= shared.to) return false;
+    show((const Looks&)shared);
+    shared.from = shared.to = 0;
+    return true;
+  }
+
+  // every live particle's looks to be shared again, e.g. for a new buffer
+  void touchLooks() { touch(0, size()); }
+
+ private:
+  enum { BLOCK = 4096 };  // particles a generator makes in fill()
+
+  void clear() {
+    mesh.vertices().clear();
+    mesh.colors().clear();
+    mesh.texCoord2s().clear();
+    velocity.clear();
+    acceleration.clear();
+    mass.clear();
+    handleAt.clear();
+    changes++;
+  }
+
+  // slots [from, to) changed looks
+  void touch(size_t from, size_t to) {
+    if (dirtyFrom >= dirtyTo) {
+      dirtyFrom = from;
+      dirtyTo = to;
+    } else {
+      dirtyFrom = std::min(dirtyFrom, from);
+      dirtyTo = std::max(dirtyTo, to);
+    }
+  }
+
+  void pop() {
+    mesh.vertices().pop_back();
+    mesh.colors().pop_back();
+    mesh.texCoord2s().pop_back();
+    velocity.pop_back();
+    acceleration.pop_back();
+    mass.pop_back();
+    handleAt.pop_back();
+  }
+
+  al::Mesh& mesh;
+  std::vector<al::Vec3f>& velocity;
+  std::vector<al::Vec3f>& acceleration;
+  std::vector<float>& mass;
+
+  std::vector<uint32_t> slotOf;    // handle -> slot, NONE if free
+  std::vector<uint32_t> handleAt;  // slot -> handle
+  std::vector<uint32_t> unused;    // handles free to give out
+  size_t room = 0;
+  uint64_t changes = 0;
+  size_t dirtyFrom = 0, dirtyTo = 0;  // the stepping thread's, not shared yet
+  Looks shared;                       // what the drawing thread takes
+  std::mutex sharing;
+};
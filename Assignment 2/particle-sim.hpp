@@ -0,0 +1,595 @@
+#pragma once
+
+// what particles-p1, -p3 and -p4 have in common: the parameters, the pool of
+// particles, the solvers and integrators, the sim thread, recording and
+// playback, and drawing. an app derives from ParticleSim and gives it the
+// parts that are its own: the physics of its Euler step (eulerStep), its
+// pairs loop (pairForces), its gravity (gravity) and any controls of its own
+// (controls). every app offers every solver and both integrators.
+//
+// this is the apps' own header, and like them it uses al and std unqualified.
+
+#include "al/app/al_App.hpp"
+#include "al/app/al_GUIDomain.hpp"
+#include "al/math/al_Random.hpp"
+
+#include "../common/frame-profiler.hpp"
+#include "../common/sim-thread.hpp"
+#include "../common/stream-buffer.hpp"
+#include "nbody-kernel.hpp"
+#include "nbody-leapfrog.hpp"
+#include "nbody-octree.hpp"
+#include "nbody-pm.hpp"
+#include "particle-pool.hpp"
+#include "trajectory-file.hpp"
+
+using namespace al;
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+inline Vec3f randomVec3f(float scale) {
+  //takes in scale parameter
+  return Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS()) * scale;
+}
+string slurp(string fileName);  // each app has its own
+
+struct ParticleSim : App {
+  Parameter pointSize{"/pointSize", "", 5.0, "", 0.0, 5.0};
+  ParameterBool pointSprites{"/pointSprites", "", 0.0};  // no geometry shader
+  Parameter timeStep{"/timeStep", "", 0.1, "", 0.01, 0.6};
+  Parameter gravConstant{"/gravConstant", "", 0.1, "", 0.0, 5.0};
+  ParameterBool simThread{"/simThread", "", 0.0};  // step on its own thread
+  Parameter simRate{"/simRate", "", 60, "", 10, 240};  // steps a second there
+  Parameter stepsPerSecond{"stepsPerSecond", "", 0, "", 0, 1000};  // measured
+  Parameter framesPerSecond{"framesPerSecond", "", 0, "", 0, 240};
+  enum { PAIRS, BARNES_HUT, DIRECT, PARTICLE_MESH };  // solver's choices
+  ParameterMenu solver{"/solver"};  // how the gravity is summed
+  Parameter theta{"/theta", "", 0.7, "", 0.0, 1.5};  // barnes-hut opening
+  Parameter softening{"/softening", "", 0.05, "", 0.0, 1.0};
+  ParameterMenu meshCells{"/meshCells"};  // particle-mesh grid, a side
+  Parameter forceError{"forceError", "", 0, "", 0, 10};  // %, median
+  Parameter forceErrorMax{"forceErrorMax", "", 0, "", 0, 10};
+  enum { EULER, LEAPFROG };  // integrator's choices
+  ParameterMenu integrator{"/integrator"};
+  Parameter energyDrift{"energyDrift", "", 0, "", 0, 100};  // %, measured
+  // particles' forces worked out per second of simulated time
+  Parameter forceEvaluations{"forceEvaluations", "", 0, "", 0, 1e6};
+  Parameter burst{"/burst", "", 100, "", 1, 10000};  // 'e' emits, 'k' kills
+  Parameter escape{"/escape", "", 0, "", 0, 100};  // retired past it, 0 never
+  Parameter live{"live", "", 0, "", 0, 1e7};  // particles now
+  ParameterBool record{"/record", "", 0.0};  // every step to recordPath
+  Parameter recorded{"recorded", "", 0, "", 0, 1e6};  // steps written
+  ParameterBool playback{"/playback", "", 0.0};  // recordPath, not the sim
+  Parameter playFrame{"/playFrame", "", 0, "", 0, 1};  // where in it
+
+  ShaderProgram pointShader;
+  ShaderProgram spriteShader;
+  float maxPointSize = 64;  // pixels, the biggest sprite the GL draws
+  ProfilerPanel profilerPanel;  // frame times, see common/frame-profiler.hpp
+
+  //  simulation state
+  Mesh mesh;  // position *is inside the mesh* mesh.vertices() are the positions
+  StreamMesh stream;  // what is drawn: the integration writes the positions
+  vector<Vec3f> velocity;
+  vector<Vec3f> acceleration;
+  vector<float> mass;
+  int particles = 50;
+  int capacity = 0;  // room for as many; 0 for twice particles
+  // emits and kills particles, keeping the mesh and the arrays above in step
+  ParticlePool particlePool{mesh, velocity, acceleration, mass};
+  atomic<int> emits{0}, kills{0};  // 'e' and 'k': for the next step
+  rnd::Random<> emitRandom;  // the stepping thread's
+  atomic<bool> kick{false};  // '1' was pressed: random forces next step
+  atomic<bool> freeze{false};  // space: nothing moves
+  RateMeter steps, frames;
+  PositionSnapshots snapshots;  // the sim thread's steps, to draw
+  Octree octree;
+  DirectSum directSum;
+  ParticleMesh particleMesh;
+  ThreadPool pool;  // for the solvers
+  int forceChecks = 0;
+  BlockLeapfrog leapfrog;
+  double energyStart = 0;  // what energyDrift is from, 0 for not yet
+  int energyChecks = 0;
+  int energyIntegrator = -1;  // what energyStart was measured with
+  float energyG = 0, energySoftening = 0;
+  string recordPath = "particles.trj";
+  TrajectoryRecorder recorder;  // the stepping thread's
+  uint64_t stepCount = 0;
+  double simTime = 0;
+  TrajectoryFile recording;  // mapped while it plays back
+  size_t playing = 0, shown = -1;  // its frame, and the one in the stream
+  float playShown = 0;  // what playFrame was set to
+  SimThread sim;  // last, so it stops before the state goes
+
+  // the app's own physics: one semi-implicit Euler step from the
+  // accelerations (see forces()), its new positions written to out as well
+  virtual void eulerStep(Vec3f *out) = 0;
+  // every pair, each once: the O(n^2) loop, equal and opposite forces of
+  // gravity() / r^2
+  virtual void pairForces() = 0;
+  // the G every solver sums with, and the energy is measured with
+  virtual float gravity() { return gravConstant; }
+  // anything the app adds to the GUI, after the gravity
+  virtual void controls(ControlGUI &gui) {}
+
+  void onInit() override {
+    // set up GUI
+    auto GUIdomain = GUIDomain::enableGUI(defaultWindowDomain());
+    auto &gui = GUIdomain->newGUI();
+    gui.add(pointSize);  // add parameter to GUI
+    gui.add(pointSprites);
+    gui.add(timeStep);   // add parameter to GUI
+    gui.add(gravConstant);
+    controls(gui);
+    gui.add(simThread);
+    gui.add(simRate);
+    gui.add(stepsPerSecond);
+    gui.add(framesPerSecond);
+    solver.setElements({"pairs", "barnes-hut", "direct", "particle-mesh"});
+    gui.add(solver);
+    gui.add(theta);
+    gui.add(softening);
+    meshCells.setElements({"32", "64", "128"});
+    meshCells.set(1);
+    gui.add(meshCells);
+    gui.add(forceError);
+    gui.add(forceErrorMax);
+    integrator.setElements({"euler", "block leapfrog"});
+    gui.add(integrator);
+    gui.add(energyDrift);
+    gui.add(forceEvaluations);
+    gui.add(burst);
+    gui.add(escape);
+    gui.add(live);
+    gui.add(record);
+    gui.add(recorded);
+    gui.add(playback);
+    gui.add(playFrame);
+    profilerPanel.add(*GUIdomain, {"onAnimate", "step", "octree", "direct",
+                                   "pm", "onDraw", "draw"});
+    //
+  }
+
+  // past a few thousand particles only barnes-hut keeps up, past a few
+  // hundred thousand only particle-mesh
+  void pickSolver() {
+    if (particles > 200000)
+      solver.set(PARTICLE_MESH);
+    else if (particles > 2000)
+      solver.set(BARNES_HUT);
+  }
+
+  void onCreate() override {
+
+    // compile shaders
+    pointShader.compile(slurp("../point-vertex.glsl"),
+                        slurp("../point-fragment.glsl"),
+                        slurp("../point-geometry.glsl"));
+    spriteShader.compile(slurp("../point-sprite-vertex.glsl"),
+                         slurp("../point-sprite-fragment.glsl"));
+    float pointSizes[2] = {1, maxPointSize};
+    glGetFloatv(GL_POINT_SIZE_RANGE, pointSizes);
+    maxPointSize = pointSizes[1];
+
+    // set initial conditions of the simulation
+    //
+
+    mesh.primitive(Mesh::POINTS);
+    // does 1000 work on your system? how many can you make before you get a low
+    // frame rate? do you need to use <1000?
+
+    //amount of particles, made on every thread, with room to emit more
+    particlePool.reserve(capacity > 0 ? capacity : 2 * particles);
+    particlePool.fill(particles,
+                      [](size_t, rnd::Random<> &r) { return newParticle(r); },
+                      pool);
+
+    // colors and sizes go to the GPU when they change, positions every frame
+    stream.create(particlePool.capacity(), false);
+    particlePool.shareLooks();
+    showLooks();
+    stream.begin();
+    copy(mesh.vertices().begin(), mesh.vertices().end(), stream.positions);
+    stream.end(mesh.vertices().size());
+
+    nav().pos(0, 0, 10);
+    cout << "force kernel: " << kernelName(directSum.kernel) << endl;
+  }
+
+  // a particle as onCreate and 'e' make them. r is the caller's: fill() hands
+  // each block of particles its own, so they can be made on every thread
+  static Particle newParticle(rnd::Random<> &r) {
+    Particle p;
+    p.position = Vec3f(r.uniformS(), r.uniformS(), r.uniformS()) * 5;
+    p.color = HSV(r.uniform(), 1.0f, 1.0f);
+
+    // float m = rnd::uniform(3.0, 0.5);
+    float m = 3 + r.normal() / 2;
+    if (m < 0.5) m = 0.5;
+    p.mass = m;
+
+    // using a simplified volume/size relationship
+    p.texCoord = Vec2f(pow(m, 1.0f / 3), 0);  // s, t
+
+    p.velocity = Vec3f(r.uniformS(), r.uniformS(), r.uniformS()) * 0.1;
+    p.acceleration = Vec3f(r.uniformS(), r.uniformS(), r.uniformS());
+    return p;
+  }
+
+  // the colors and sizes go to the GPU again only for the slots particles
+  // came to or went from, whichever thread stepped them. with the sim
+  // thread they can be a step ahead of the positions drawn, for a frame
+  void showLooks() {
+    particlePool.takeLooks([this](const ParticlePool::Looks &looks) {
+      stream.fixedColors(looks.colors.data(), looks.from, looks.to);
+      stream.fixedTexCoords(looks.texCoords.data(), looks.from, looks.to);
+    });
+  }
+
+  void onAnimate(double dt) override {
+    PROFILE_FRAME();
+    profilerPanel.update();
+    frames.tick();
+    stepsPerSecond.setNoCalls(steps.perSecond());
+    framesPerSecond.setNoCalls(frames.perSecond());
+    PROFILE("onAnimate");
+
+    if (playback) {
+      showRecording();
+      return;
+    }
+    if (recording.valid()) stopPlayback();
+
+    if (simThread != sim.running()) startOrStopSim();
+    if (sim.running()) {
+      // where the particles were a step ago, between the last two steps
+      // the thread published; the motion stays smooth at any frame rate
+      sim.rate(simRate);
+      stream.begin();
+      size_t n = snapshots.interpolate(SimThread::now() - sim.interval(),
+                                       stream.positions);
+      stream.end(n);
+      showLooks();
+      return;
+    }
+
+    if (freeze) return;
+    stream.begin();
+    step(stream.positions);
+    stream.end(velocity.size());
+    showLooks();
+  }
+
+  // simThread changed: the thread takes over from the current state, or
+  // stops and leaves it for onAnimate to carry on from
+  void startOrStopSim() {
+    if (!simThread) {
+      sim.stop();
+      return;
+    }
+    snapshots.reset(mesh.vertices(), SimThread::now(), particlePool.layout(),
+                    particlePool.capacity());
+    sim.start(simRate, [this](double t) {
+      if (freeze) return;
+      step(snapshots.back());
+      snapshots.publish(t, velocity.size(), particlePool.layout());
+    });
+  }
+
+  // the run recorded at recordPath instead of the simulation, a step a frame;
+  // space holds it and playFrame moves through it. positions are copied from
+  // the mapped file straight into the GPU buffer, colored by speed and sized
+  // by mass, all three streamed
+  void showRecording() {
+    if (!recording.valid()) {
+      sim.stop();  // nothing steps while it plays
+      recorder.close();
+      record.setNoCalls(0);
+      if (!recording.open(recordPath) || recording.frames() == 0) {
+        cout << "no recording in " << recordPath << endl;
+        recording.close();
+        playback.setNoCalls(0);
+        return;
+      }
+      stream.create(recording.mostParticles(), true, true);
+      playing = 0;
+      shown = -1;
+      playShown = -1;
+    }
+
+    size_t frames = recording.frames();
+    if (playFrame != playShown)  // moved by hand
+      playing = min(frames - 1, size_t(playFrame * (frames - 1) + 0.5));
+    else if (!freeze)
+      playing = (playing + 1) % frames;
+    playShown = frames > 1 ? float(playing) / (frames - 1) : 0;
+    playFrame.setNoCalls(playShown);
+    recording.willNeed(playing + 1);
+    if (playing == shown) return;  // drawn already
+
+    TrajectoryFile::Frame f = recording.frame(playing);
+    stream.begin();
+    copy(f.position, f.position + f.particles, stream.positions);
+    for (size_t i = 0; i < f.particles; i++) {
+      float speed = f.velocity[i].mag();
+      stream.colors[i] = HSV(0.66f / (1 + speed), 1.0f, 1.0f);  // red is fast
+      stream.texCoords[i] = Vec2f(pow(f.mass[i], 1.0f / 3), 0);
+    }
+    stream.end(f.particles);
+    shown = playing;
+  }
+
+  // back to the simulation, where it was when playback started
+  void stopPlayback() {
+    recording.close();
+    stream.create(particlePool.capacity(), false);
+    particlePool.touchLooks();  // a new buffer: all of them
+    particlePool.shareLooks();
+    showLooks();
+    stream.begin();
+    copy(mesh.vertices().begin(), mesh.vertices().end(), stream.positions);
+    stream.end(mesh.vertices().size());
+  }
+
+  // while record is on, the state each step starts from goes to recordPath.
+  // the recorder writes on its own thread: a slow disk drops steps rather
+  // than holding this one up
+  void recordStep() {
+    if (record != recorder.recording()) {
+      if (!record)
+        recorder.close();
+      else if (!recorder.open(recordPath)) {
+        cout << "can't record to " << recordPath << endl;
+        record.setNoCalls(0);
+      }
+    }
+    if (!recorder.recording()) return;
+    recorder.record(stepCount, simTime, velocity.size(), mesh.vertices().data(),
+                    velocity.data(), mass.data());
+    recorded.setNoCalls(recorder.frames());
+  }
+
+  // one step of the simulation, on the graphics thread or the sim thread
+  // (never both); the new positions are written to out as well
+  void step(Vec3f *out) {
+    PROFILE("step");
+    steps.tick();
+    changePopulation();
+    if (velocity.empty()) return;
+    recordStep();
+    stepCount++;
+    simTime += timeStep;
+
+    if (integrator != energyIntegrator || gravity() != energyG ||
+        softening != energySoftening) {
+      leapfrog.reset();  // its accelerations are of the old gravity
+      restartEnergy();
+      // the leapfrog takes acceleration as forces the octree and the mesh
+      // summed; the kick a particle was made with is not one of them
+      if (integrator == LEAPFROG)
+        for (auto &a : acceleration) a.zero();
+    }
+    if (integrator == LEAPFROG) {
+      leapfrogStep(out);
+      return;
+    }
+    leapfrog.reset();  // it starts over from wherever this leaves things
+    forceEvaluations.setNoCalls(velocity.size() / timeStep);
+    eulerStep(out);
+    checkEnergy();
+  }
+
+  // the accelerations from gravity, by the chosen solver, added to those
+  // already there; eulerStep calls it
+  void forces() {
+    if (solver == BARNES_HUT)
+      barnesHutForces();
+    else if (solver == DIRECT)
+      directForces();
+    else if (solver == PARTICLE_MESH)
+      meshForces();
+    else
+      pairForces();
+  }
+
+  // kick-drift-kick with a step per particle (nbody-leapfrog.hpp): a frame's
+  // timeStep is cut into as many as 64 only for the particles in close
+  // encounters. no drag and no clamp, so the energy should hold still
+  void leapfrogStep(Vec3f *out) {
+    vector<Vec3f> &position(mesh.vertices());
+    if (kick.exchange(false)) {
+      for (int i = 0; i < velocity.size(); i++)
+        velocity[i] += randomVec3f(5) / mass[i] * timeStep;
+      restartEnergy();
+    }
+    leapfrog.step(position, velocity, mass, timeStep, softening,
+                  [this](const vector<uint32_t> &active, vector<Vec3f> &force) {
+                    activeForces(active, force);
+                  });
+    for (int i = 0; i < velocity.size(); i++) out[i] = position[i];
+    forceEvaluations.setNoCalls(leapfrog.evaluations / leapfrog.simulated);
+    checkEnergy();
+  }
+
+  // the forces on the particles the leapfrog has due. the direct sum works
+  // out just theirs; the octree and the mesh do everyone's and hand theirs
+  // on. the pairs loop's forces are the direct sum's, unsoftened, so the
+  // direct sum gives them here too
+  void activeForces(const vector<uint32_t> &active, vector<Vec3f> &force) {
+    if (solver == BARNES_HUT || solver == PARTICLE_MESH) {
+      if (solver == BARNES_HUT)
+        barnesHutForces();
+      else
+        meshForces();
+      for (uint32_t i : active) force[i] += acceleration[i];
+      for (auto &a : acceleration) a.zero();
+      return;
+    }
+    PROFILE("direct");
+    directSum.accumulate(mesh.vertices(), active, gravity(), softening, force,
+                         pool);
+  }
+
+  // how far the energy has come from where it was when the integrator, the
+  // gravity or the particles last changed. the sum is every pair, so past a
+  // few thousand particles it isn't measured
+  void checkEnergy() {
+    if (velocity.size() > 4000 || energyChecks++ % 60 != 0) return;
+    double e =
+        energy(mesh.vertices(), velocity, mass, gravity(), softening).total();
+    if (energyStart == 0)
+      energyStart = e;
+    else
+      energyDrift.setNoCalls(fabs(e - energyStart) / fabs(energyStart) * 100);
+  }
+
+  void restartEnergy() {
+    energyIntegrator = integrator;
+    energyG = gravity();
+    energySoftening = softening;
+    energyStart = 0;
+    energyChecks = 0;
+    energyDrift.setNoCalls(0);
+  }
+
+  // particles come and go between steps: those 'e' and 'k' asked for, and
+  // those past the escape radius. the pool moves the last particle into a
+  // killed one's place, so the integrator and the energy start over
+  void changePopulation() {
+    bool changed = false;
+    for (int k = emits.exchange(0); k > 0; k--) {
+      Particle p = newParticle(emitRandom);
+      if (integrator == LEAPFROG) p.acceleration.zero();  // as in step()
+      if (particlePool.emit(p) == ParticlePool::NONE) break;  // full
+      changed = true;
+    }
+    for (int k = kills.exchange(0); k > 0 && particlePool.size() > 0; k--) {
+      size_t n = particlePool.size();
+      particlePool.killAt(min(n - 1, size_t(emitRandom.uniform() * n)));
+      changed = true;
+    }
+    if (escape > 0) {
+      const vector<Vec3f> &position(mesh.vertices());
+      float r2 = escape * escape;
+      for (size_t i = 0; i < particlePool.size();) {
+        if (position[i].magSqr() > r2) {
+          particlePool.killAt(i);  // the last one is in i now
+          changed = true;
+        } else {
+          i++;
+        }
+      }
+    }
+    if (changed) {
+      leapfrog.reset();
+      restartEnergy();
+      particlePool.shareLooks();
+    }
+    live.setNoCalls(particlePool.size());
+  }
+
+  // gravity() / r^2 toward every other particle, softened (see
+  // nbody-forces.hpp), from an octree rebuilt every step
+  void barnesHutForces() {
+    PROFILE("octree");
+    const vector<Vec3f> &position(mesh.vertices());
+    octree.build(position);
+    octree.accumulate(gravity(), theta, softening, acceleration, pool);
+    checkForces([&](size_t i) { return octree.force(i); });
+  }
+
+  // now and then, how far an approximate solver is from the exact sum; fewer
+  // samples the more particles, each one being a pass over all of them
+  template <typename Approx>
+  void checkForces(Approx approx) {
+    if (forceChecks++ % 120 != 0) return;
+    const vector<Vec3f> &position(mesh.vertices());
+    int samples = max(8, min(64, int(4e6 / max<size_t>(1, position.size()))));
+    ForceError e =
+        measureForceError(position, gravity(), softening, samples, approx);
+    forceError.setNoCalls(e.median * 100);
+    forceErrorMax.setNoCalls(e.max * 100);
+  }
+
+  // the exact softened sum, vectorized for this CPU and split between the
+  // pool's threads (nbody-kernel.hpp); the same forces on any core count
+  void directForces() {
+    PROFILE("direct");
+    directSum.accumulate(mesh.vertices(), gravity(), softening, acceleration,
+                         pool);
+  }
+
+  // the smooth field of many particles from a grid fitted around them
+  // (nbody-pm.hpp): linear in their number, blurred below a cell
+  void meshForces() {
+    PROFILE("pm");
+    particleMesh.size = 32 << meshCells.get();
+    particleMesh.accumulate(mesh.vertices(), gravity(), softening,
+                            acceleration, pool);
+    checkForces([&](size_t i) { return particleMesh.force(i); });
+  }
+
+  bool onKeyDown(const Keyboard &k) override {
+    if (k.key() == 'i') {
+      const vector<Vec3f> &position =
+          sim.running() ? snapshots.latest() : mesh.vertices();
+      int n = sim.running() ? snapshots.size() : velocity.size();
+      Vec3f sum(0, 0, 0);
+      for (int i = 0; i < n; i++) {
+        sum += position[i];
+      }
+      if (n > 0) sum /= n;
+      nav().pos(sum);
+    }
+
+    if (k.key() == ' ') {
+      freeze = !freeze;
+    }
+
+    if (k.key() == '1') {
+      kick = true;  // the next step applies them
+    }
+
+    if (k.key() == 'e') {
+      emits += int(burst);  // the next step makes them
+    }
+
+    if (k.key() == 'k') {
+      kills += int(burst);
+    }
+
+    return true;
+  }
+
+  void onDraw(Graphics &g) override {
+    PROFILE("onDraw");
+    g.clear(0.3);
+    if (pointSprites) {
+      glEnable(GL_PROGRAM_POINT_SIZE);
+      g.shader(spriteShader);
+      g.shader().uniform("viewportSize", float(fbWidth()), float(fbHeight()));
+      g.shader().uniform("maxPointSize", maxPointSize);
+    } else {
+      g.shader(pointShader);
+    }
+    g.shader().uniform("pointSize", pointSize / 100);
+    g.blending(true);
+    g.blendTrans();
+    g.depthTesting(true);
+    {
+      PROFILE("draw");
+      stream.draw(g, GL_POINTS);
+    }
+  }
+
+  void onExit() override {
+    sim.stop();
+    recorder.close();
+  }
+};
@@ -0,0 +1,18 @@
+#version 400
+
+in Fragment {
+  vec4 color;
+  flat vec2 center;
+  flat vec2 halfSize;
+}
+fragment;
+
+layout(location = 0) out vec4 fragmentColor;
+
+void main() {
+  // where this pixel is on the geometry shader's quad, -1 to 1
+  vec2 mapping = (gl_FragCoord.xy - fragment.center) / fragment.halfSize;
+  float r = dot(mapping, mapping);
+  if (r > 1) discard;
+  fragmentColor = vec4(fragment.color.rgb, 1 - r * r);
+}
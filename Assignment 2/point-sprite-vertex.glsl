@@ -0,0 +1,40 @@
+#version 400
+
+// point-vertex.glsl and point-geometry.glsl without the geometry shader: the
+// point is drawn as a gl_PointSize sprite a little bigger than the quad the
+// geometry shader makes, and point-sprite-fragment.glsl works out where each
+// pixel is on that quad, so the splats come out the same. except: a sprite is
+// at most maxPointSize pixels (GL_POINT_SIZE_RANGE), so a bigger splat is
+// shrunk to fit, and a point is clipped by its center, so a splat whose
+// center leaves the view is dropped whole, up to a radius early
+
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 1) in vec4 vertexColor;
+layout(location = 2) in vec2 vertexSize;  // only x is used
+
+uniform mat4 al_ModelViewMatrix;
+uniform mat4 al_ProjectionMatrix;
+uniform float pointSize;
+uniform vec2 viewportSize;  // pixels
+uniform float maxPointSize;  // pixels, the biggest sprite
+
+out Fragment {
+  vec4 color;
+  // the quad's center and half size in window coordinates
+  flat vec2 center;
+  flat vec2 halfSize;
+}
+fragment;
+
+void main() {
+  gl_Position = al_ProjectionMatrix * al_ModelViewMatrix * vec4(vertexPosition, 1.0);
+  vec2 scale = vec2(al_ProjectionMatrix[0][0], al_ProjectionMatrix[1][1]);
+  float r = pointSize * vertexSize.x;
+  fragment.color = vertexColor;
+  fragment.center = (gl_Position.xy / gl_Position.w * 0.5 + 0.5) * viewportSize;
+  fragment.halfSize = r * scale * viewportSize * 0.5 / gl_Position.w;
+  float size = 2.0 * max(fragment.halfSize.x, fragment.halfSize.y) + 2.0;
+  // the whole splat shrinks to fit, rather than being cut square
+  fragment.halfSize *= min(1.0, (maxPointSize - 2.0) / max(size - 2.0, 1.0));
+  gl_PointSize = min(size, maxPointSize);
+}
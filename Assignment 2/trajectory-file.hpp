@@ -0,0 +1,353 @@
+#pragma once
+
+// a run of the particle apps on disk, to look at or draw again afterwards.
+//
+// the file is a fixed 64 byte header, then one frame per step appended as
+// the run goes, then an index of where each frame starts:
+//
+//   header | frame | frame | ... | frame | index (uint64 offset per frame)
+//
+// a frame is a 32 byte frame header (step, time, particles, bytes) and then
+// its columns one after another: the positions and velocities as al::Vec3f
+// and the masses as float, exactly as the apps keep them, padded to 8 bytes.
+// a reader maps the file and a frame's columns are pointers into it; nothing
+// is parsed or copied, and the OS pages in only the frames that are looked
+// at, so a run can be much bigger than memory.
+//
+// the index, the frame count and the most particles in any frame go in when
+// the recorder closes. a run that never closed (a crash) has none of them,
+// and the reader walks the frame headers instead, one hop each, up to the
+// last frame that was written whole. either way every frame is checked to
+// lie whole inside the file before it is looked at, and the run ends at the
+// last one that does.
+//
+// TrajectoryRecorder writes on its own thread. the stepping thread copies a
+// step into one of a few frame buffers and hands it over through a lock-free
+// queue; when the disk falls that far behind the step is dropped (and
+// counted) rather than waited for.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "al/math/al_Vec.hpp"
+
+#include "../common/spsc-queue.hpp"
+
+namespace trajectory {
+
+const char magic[8] = {'P', 'A', 'R', 'T', 'T', 'R', 'J', 0};
+const uint32_t version = 1;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t frameHeaderBytes;
+  uint64_t frames;       // 0 until the recorder closes
+  uint64_t indexOffset;  // 0 until the recorder closes
+  uint64_t mostParticles;  // in any frame; 0 until the recorder closes
+  uint8_t reserved[24];
+};
+static_assert(sizeof(Header) == 64, "trajectory header must stay 64 bytes");
+
+struct FrameHeader {
+  uint64_t step;
+  double time;
+  uint32_t particles;
+  uint32_t reserved;
+  uint64_t bytes;  // the whole frame, this header included
+};
+static_assert(sizeof(FrameHeader) == 32, "frame header must stay 32 bytes");
+static_assert(sizeof(al::Vec3f) == 12, "positions are stored as al::Vec3f");
+
+inline uint64_t frameBytes(uint64_t particles) {
+  uint64_t bytes = sizeof(FrameHeader) + particles * (2 * 12 + 4);
+  return (bytes + 7) / 8 * 8;
+}
+
+}  // namespace trajectory
+
+// stepping thread: record() every step; open() and close() from the same
+// thread, or while it isn't stepping
+class TrajectoryRecorder {
+ public:
+  TrajectoryRecorder() {}
+  TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+  TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+  ~TrajectoryRecorder() { close(); }
+
+  bool open(const std::string& path) {
+    close();
+    file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    trajectory::Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, trajectory::magic, sizeof(h.magic));
+    h.version = trajectory::version;
+    h.frameHeaderBytes = sizeof(trajectory::FrameHeader);
+    if (fwrite(&h, sizeof(h), 1, file) != 1) {
+      fclose(file);
+      file = nullptr;
+      return false;
+    }
+    offset = sizeof(h);
+    index.clear();
+    most = 0;
+    recorded = dropped = 0;
+    failed = false;
+    for (int slot = 0; slot < SLOTS; slot++) unused.push(slot);
+    stopping = false;
+    writer = std::thread([this]() { run(); });
+    return true;
+  }
+
+  bool recording() const { return file != nullptr; }
+
+  // copies n particles' state into a free frame buffer for the writer;
+  // false if there was none (the step is dropped, not waited for)
+  bool record(uint64_t step, double time, size_t n, const al::Vec3f* position,
+              const al::Vec3f* velocity, const float* mass) {
+    if (!file) return false;
+    int slot;
+    if (!unused.pop(slot)) {
+      dropped++;
+      return false;
+    }
+    std::vector<uint8_t>& f = buffers[slot];
+    f.resize(trajectory::frameBytes(n));  // allocates only for a bigger run
+    trajectory::FrameHeader h = {step, time, uint32_t(n), 0, f.size()};
+    uint8_t* p = f.data();
+    memcpy(p, &h, sizeof(h));
+    p += sizeof(h);
+    memcpy(p, position, n * sizeof(al::Vec3f));
+    p += n * sizeof(al::Vec3f);
+    memcpy(p, velocity, n * sizeof(al::Vec3f));
+    p += n * sizeof(al::Vec3f);
+    memcpy(p, mass, n * sizeof(float));
+    written.push(slot);  // never full: there are only SLOTS slots
+    return true;
+  }
+
+  // waits for the writer to finish, then adds the index, the frame count and
+  // the most particles
+  void close() {
+    if (!file) return;
+    stopping = true;
+    writer.join();
+    trajectory::Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, trajectory::magic, sizeof(h.magic));
+    h.version = trajectory::version;
+    h.frameHeaderBytes = sizeof(trajectory::FrameHeader);
+    h.frames = index.size();
+    h.indexOffset = offset;
+    h.mostParticles = most;
+    if (!failed &&
+        fwrite(index.data(), sizeof(uint64_t), index.size(), file) ==
+            index.size() &&
+        fseek(file, 0, SEEK_SET) == 0)
+      fwrite(&h, sizeof(h), 1, file);
+    fclose(file);  // without the index it still reads, by walking the frames
+    file = nullptr;
+    int slot;
+    while (unused.pop(slot)) {
+    }
+  }
+
+  // frames on disk, and steps dropped because the writer was behind
+  uint64_t frames() const { return recorded; }
+  uint64_t drops() const { return dropped; }
+
+ private:
+  enum { SLOTS = 4 };  // frame buffers between the two threads
+
+  void run() {
+    while (true) {
+      int slot;
+      if (written.pop(slot)) {
+        const std::vector<uint8_t>& f = buffers[slot];
+        if (!failed) {
+          failed = fwrite(f.data(), 1, f.size(), file) != f.size();
+          if (!failed) {
+            index.push_back(offset);
+            offset += f.size();
+            most = std::max(
+                most, ((const trajectory::FrameHeader*)f.data())->particles);
+            recorded++;
+          }
+        }
+        unused.push(slot);
+      } else if (stopping) {
+        return;
+      } else {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+  }
+
+  FILE* file = nullptr;
+  std::thread writer;
+  std::atomic<bool> stopping{false};
+  std::vector<uint8_t> buffers[SLOTS];
+  SpscQueue<int, SLOTS> unused;   // writer -> stepping thread
+  SpscQueue<int, SLOTS> written;  // stepping thread -> writer
+  std::vector<uint64_t> index;    // the writer's
+  uint64_t offset = 0;
+  uint32_t most = 0;              // the writer's, particles in any frame
+  bool failed = false;
+  std::atomic<uint64_t> recorded{0}, dropped{0};
+};
+
+// a recorded run, mapped read-only. frames can be looked at in any order
+class TrajectoryFile {
+ public:
+  struct Frame {
+    uint64_t step = 0;
+    double time = 0;
+    size_t particles = 0;
+    const al::Vec3f* position = nullptr;
+    const al::Vec3f* velocity = nullptr;
+    const float* mass = nullptr;
+  };
+
+  TrajectoryFile() {}
+  TrajectoryFile(const TrajectoryFile&) = delete;
+  TrajectoryFile& operator=(const TrajectoryFile&) = delete;
+  ~TrajectoryFile() { close(); }
+
+  bool open(const std::string& path) {
+    close();
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        st.st_size < (off_t)sizeof(trajectory::Header)) {
+      ::close(fd);
+      return false;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+    data = (const uint8_t*)p;
+    bytes = st.st_size;
+
+    const trajectory::Header& h = *(const trajectory::Header*)data;
+    if (memcmp(h.magic, trajectory::magic, sizeof(h.magic)) != 0 ||
+        h.version != trajectory::version ||
+        h.frameHeaderBytes != sizeof(trajectory::FrameHeader)) {
+      close();
+      return false;
+    }
+    // the frames end where the index starts, if it is in the file at all
+    bool indexed = h.indexOffset != 0 && h.indexOffset % 8 == 0 &&
+                   h.indexOffset <= bytes &&
+                   h.frames <= (bytes - h.indexOffset) / sizeof(uint64_t);
+    if (indexed) {
+      offsets = (const uint64_t*)(data + h.indexOffset);
+      while (count < h.frames && whole(offsets[count], h.indexOffset)) count++;
+      most = h.mostParticles;
+      if (most == 0)  // recorded before the header had it
+        for (size_t i = 0; i < count; i++)
+          most = std::max<size_t>(most, header(offsets[i]).particles);
+    } else {
+      walk(h.indexOffset != 0 && h.indexOffset <= bytes ? h.indexOffset
+                                                         : bytes);
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void close() {
+#ifndef _WIN32
+    if (data) munmap((void*)data, bytes);
+#endif
+    data = nullptr;
+    bytes = 0;
+    offsets = nullptr;
+    count = 0;
+    most = 0;
+    walked.clear();
+  }
+
+  bool valid() const { return data != nullptr; }
+  size_t frames() const { return count; }
+  // the most particles in any frame, from the header without looking at them:
+  // room for this many holds every frame
+  size_t mostParticles() const { return most; }
+
+  // frame i, as pointers into the file. one with more particles than the
+  // header says any has (a damaged header) is cut to mostParticles()
+  Frame frame(size_t i) const {
+    const uint8_t* p = data + offsets[i];
+    const trajectory::FrameHeader& h = *(const trajectory::FrameHeader*)p;
+    Frame f;
+    f.step = h.step;
+    f.time = h.time;
+    f.particles = std::min<size_t>(h.particles, most);
+    f.position = (const al::Vec3f*)(p + sizeof(h));
+    f.velocity = f.position + h.particles;
+    f.mass = (const float*)(f.velocity + h.particles);
+    return f;
+  }
+
+  // frame i will be wanted soon: the OS can start reading it in now
+  void willNeed(size_t i) const {
+#ifndef _WIN32
+    if (i >= count) return;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t from = offsets[i] / page * page;
+    size_t to = offsets[i] + header(offsets[i]).bytes;
+    madvise((void*)(data + from), to - from, MADV_WILLNEED);
+#endif
+  }
+
+ private:
+  // a frame starts at at, aligned, and it and its columns end by end
+  bool whole(uint64_t at, uint64_t end) const {
+    if (at < sizeof(trajectory::Header) || at % 8 != 0 || at > end ||
+        end - at < sizeof(trajectory::FrameHeader))
+      return false;
+    const trajectory::FrameHeader& h = header(at);
+    return h.bytes == trajectory::frameBytes(h.particles) &&
+           h.bytes <= end - at;
+  }
+
+  const trajectory::FrameHeader& header(uint64_t at) const {
+    return *(const trajectory::FrameHeader*)(data + at);
+  }
+
+  // no index: hop from frame header to frame header up to end
+  void walk(uint64_t end) {
+    uint64_t at = sizeof(trajectory::Header);
+    while (whole(at, end)) {  // not: the frame being written when it stopped
+      walked.push_back(at);
+      most = std::max<size_t>(most, header(at).particles);
+      at += header(at).bytes;
+    }
+    offsets = walked.data();
+    count = walked.size();
+  }
+
+  const uint8_t* data = nullptr;
+  size_t bytes = 0;
+  const uint64_t* offsets = nullptr;  // where each frame starts
+  size_t count = 0;
+  size_t most = 0;               // particles in any frame
+  std::vector<uint64_t> walked;  // the offsets, when the file has no index
+};
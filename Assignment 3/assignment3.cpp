@@ -29,6 +29,9 @@ Lance Putnam, Oct. 2014
 #include "al/app/al_GUIDomain.hpp"
 #include "al/math/al_Random.hpp"
 
+#include "../common/frame-profiler.hpp"
+#include "../common/stream-buffer.hpp"
+
 using namespace al;
 
 // A "boid" (play on bird) is one member of a flock.
@@ -44,7 +47,8 @@ class Boid {
 struct MyApp : public App {
   static const int Nb = 32;  // Number of boids
   Boid boids[Nb];
-  Mesh heads, tails;
+  // rebuilt every frame, written straight into GPU memory
+  StreamMesh heads, tails;
   Mesh box;
   VAOMesh mCube;
 
@@ -55,6 +59,8 @@ struct MyApp : public App {
   Parameter matchRadius{"/matchRadius", "", 0.2, "", 0.05, 1.0};
   Parameter huntUrge{"/huntUrge", "", 0.2, "", 0.1, 1.0};
   Parameter localRadius{"/localRadius", "", 1.5, "", 0.1, 5.0};
+
+  ProfilerPanel profilerPanel;  // frame times, see common/frame-profiler.hpp
   
 
   double angle{0};
@@ -67,9 +73,12 @@ struct MyApp : public App {
     gui.add(matchRadius);
     gui.add(huntUrge);
     gui.add(localRadius);
+    profilerPanel.add(*GUIdomain, {"onAnimate", "meshes", "onDraw"});
   }
 
   void onCreate() {
+    heads.create(Nb, true);
+    tails.create(2 * Nb, true);
     addCube(mCube);
     mCube.primitive(Mesh::LINE_LOOP);
     mCube.scale(4);
@@ -87,6 +96,9 @@ struct MyApp : public App {
   }
 
   void onAnimate(double dt_ms) {
+    PROFILE_FRAME();
+    profilerPanel.update();
+    PROFILE("onAnimate");
     float dt = dt_ms;
     angle += 0.1;
 
@@ -158,28 +170,30 @@ struct MyApp : public App {
     }
 
     // Generate meshes
-    heads.reset();
-    heads.primitive(Mesh::POINTS);
-
-    tails.reset();
-    tails.primitive(Mesh::LINES);
-    
+    PROFILE("meshes");
+    heads.begin();
+    tails.begin();
 
     for (int i = 0; i < Nb; ++i) {
       boids[i].update(dt);
 
-      heads.vertex(boids[i].pos);
-      heads.color(HSV(float(i) / Nb * 0.3 + 0.3, 0.7));
+      // mapped memory is only written, never read back
+      Color color = HSV(float(i) / Nb * 0.3 + 0.3, 0.7);
+      heads.positions[i] = boids[i].pos;
+      heads.colors[i] = color;
 
-      tails.vertex(boids[i].pos);
-      tails.vertex(boids[i].pos - boids[i].vel.normalized(0.07));
+      tails.positions[2 * i] = boids[i].pos;
+      tails.positions[2 * i + 1] = boids[i].pos - boids[i].vel.normalized(0.07);
 
-      tails.color(heads.colors()[i]);
-      tails.color(RGB(0.5));
+      tails.colors[2 * i] = color;
+      tails.colors[2 * i + 1] = RGB(0.5);
     }
+    heads.end(Nb);
+    tails.end(2 * Nb);
   }
 
   void onDraw(Graphics& g) {
+    PROFILE("onDraw");
     g.clear(0);
     g.depthTesting(true);
     g.pointSize(8);
@@ -188,8 +202,8 @@ struct MyApp : public App {
     // g.nicest();
     // g.stroke(8);
     g.meshColor();
-    g.draw(heads);
-    g.draw(tails);
+    heads.draw(g, GL_POINTS);
+    tails.draw(g, GL_LINES);
 
     // g.stroke(1);
     g.color(1);
@@ -0,0 +1,286 @@
+#pragma once
+
+// the audio analysis the Max patch does, done in onSound instead: the
+// pfft.multiband.level.meter gen~ code (37 ERB bands, in dB over a noise
+// floor, smoothed with the previous frame) and buffer-to-list-outputs-TYIL2.js
+// (nine band means, onsets against a short history, presence and volume).
+//
+// the audio thread runs one analysis per 512 samples (a 1024 point Hann FFT
+// with overlap 2, like pfft~ 1024) and pushes the result into a lock-free
+// queue; the graphics thread drains it once a frame. nothing on the audio
+// thread allocates or locks.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+
+#include "../../common/spsc-queue.hpp"
+
+// what one FFT frame produced; the names follow the js
+struct AnalysisFrame
+{
+  enum Band
+  {
+    LOW_BASS,
+    BASS,
+    LOW_MIDS,
+    MIDS,
+    UPPER_MIDS,
+    HIGH_MIDS,
+    UPPER_HIGH_MIDS,
+    HIGHS,
+    UPPER_HIGHS,
+    BANDS
+  };
+  enum Onset
+  {
+    // one bit per band (js outlets 10-18), then:
+    SOFT_LOW_BASS = BANDS, // outlet 19, low bass at the lower threshold
+    ALL_HIGHS,             // outlet 20
+    ANY_MIDS,              // outlet 21
+    LOWS,                  // outlet 22
+    PRESENCE               // outlet 23, presence is valid
+  };
+
+  uint64_t frame = 0;
+  float meter[37];
+  float bands[BANDS];
+  uint32_t onsets = 0;
+  int presence = 0;     // 1 (sparse) to 3 (busy)
+  float volume = 0;     // mean of the bands
+  float volumeVal = 0;  // 0, 0.5, 1, 1.5 or 2
+
+  bool onset(int which) const { return onsets & (1u << which); }
+};
+
+class AudioAnalysis
+{
+public:
+  static const int FFT_SIZE = 1024;
+  static const int HOP = FFT_SIZE / 2;
+  static const int METER_SIZE = 37;
+
+  // same as the gen~ Param
+  float noisefloor = 50;
+
+  // audio thread, before the first block (or when the rate changes)
+  void setup(double sampleRate)
+  {
+    for (int i = 0; i < FFT_SIZE; i++)
+      mWindow[i] = 0.5f - 0.5f * std::cos(2 * M_PI * i / FFT_SIZE);
+    for (int i = 0; i < FFT_SIZE / 2; i++)
+      mTwiddle[i] = std::polar(1.0f, float(-2 * M_PI * i / FFT_SIZE));
+    for (int i = 0, j = 0; i < FFT_SIZE; i++)
+    {
+      mReverse[i] = j;
+      int bit = FFT_SIZE >> 1;
+      for (; j & bit; bit >>= 1)
+        j ^= bit;
+      j |= bit;
+    }
+    // which meter band every bin lands in (the ERB warp), -1 past the last
+    for (int bin = 0; bin <= FFT_SIZE / 2; bin++)
+    {
+      double frequency = double(bin) / FFT_SIZE * sampleRate;
+      double erb = 43 + 11.17 * std::log((frequency + 312) / (frequency + 14675));
+      int erbi = int(std::min(std::max(erb, 0.0), double(METER_SIZE)));
+      mBandOf[bin] = erbi < METER_SIZE ? erbi : -1;
+    }
+    mFill = 0;
+  }
+
+  // audio thread: n mono samples
+  void process(const float *samples, int n)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      mInput[mFill++] = samples[i];
+      if (mFill == FFT_SIZE)
+      {
+        analyze();
+        // keep the newest half for the next frame
+        for (int j = 0; j < HOP; j++)
+          mInput[j] = mInput[j + HOP];
+        mFill = HOP;
+      }
+    }
+  }
+
+  // graphics thread: the next finished frame, if any
+  bool poll(AnalysisFrame &f) { return mFrames.pop(f); }
+
+  uint64_t frames() const { return mFrameCount; }
+  uint64_t dropped() const { return mDropped; } // graphics thread fell behind
+
+private:
+  void analyze()
+  {
+    for (int i = 0; i < FFT_SIZE; i++)
+      mSpectrum[mReverse[i]] = std::complex<float>(mInput[i] * mWindow[i], 0);
+    for (int size = 2; size <= FFT_SIZE; size <<= 1)
+    {
+      int half = size / 2, stride = FFT_SIZE / size;
+      for (int start = 0; start < FFT_SIZE; start += size)
+        for (int i = 0; i < half; i++)
+        {
+          std::complex<float> a = mSpectrum[start + i];
+          std::complex<float> b = mSpectrum[start + i + half] * mTwiddle[i * stride];
+          mSpectrum[start + i] = a + b;
+          mSpectrum[start + i + half] = a - b;
+        }
+    }
+
+    // the gen~ meter
+    AnalysisFrame f;
+    for (int i = 0; i < METER_SIZE; i++)
+      f.meter[i] = 0;
+    for (int bin = 0; bin <= FFT_SIZE / 2; bin++)
+      if (mBandOf[bin] >= 0)
+        f.meter[mBandOf[bin]] += std::abs(mSpectrum[bin]);
+    for (int i = 0; i < METER_SIZE; i++)
+    {
+      float db = 20 * std::log10(std::max(f.meter[i] / FFT_SIZE, 1e-12f));
+      float normalized = (std::min(std::max(db, -noisefloor), 0.0f) + noisefloor) / noisefloor;
+      f.meter[i] = mMeter[i] = normalized * 0.5f + mMeter[i] * 0.5f;
+    }
+
+    classify(f);
+    f.frame = ++mFrameCount;
+    if (!mFrames.push(f))
+      mDropped++;
+  }
+
+  // the js, one bang per frame
+  void classify(AnalysisFrame &f)
+  {
+    static const int first[AnalysisFrame::BANDS] = {2, 5, 8, 12, 15, 21, 27, 30, 34};
+    static const int last[AnalysisFrame::BANDS] = {4, 7, 11, 14, 20, 26, 29, 33, 36};
+    static const float threshold[AnalysisFrame::BANDS] = {0.11f, 0.07f, 0.07f, 0.05f, 0.08f,
+                                                          0.08f, 0.06f, 0.08f, 0.08f};
+    float sum = 0;
+    bool bang[AnalysisFrame::BANDS];
+    for (int b = 0; b < AnalysisFrame::BANDS; b++)
+    {
+      float mean = 0;
+      for (int i = first[b]; i <= last[b]; i++)
+        mean += f.meter[i];
+      mean /= last[b] - first[b] + 1;
+      f.bands[b] = mean;
+      sum += mean;
+      bang[b] = mHistory[b].onset(mean, threshold[b]);
+      mHistory[b].push(mean);
+    }
+    // the js checks low bass twice and pushes it twice, so its history only
+    // covers a frame and a half; kept as is, the thresholds were tuned on it
+    bool softLowBass = mHistory[AnalysisFrame::LOW_BASS].onset(f.bands[AnalysisFrame::LOW_BASS], 0.06f);
+    mHistory[AnalysisFrame::LOW_BASS].push(f.bands[AnalysisFrame::LOW_BASS]);
+
+    using A = AnalysisFrame;
+    uint32_t onsets = 0;
+    for (int b = 0; b < A::BANDS; b++)
+      if (bang[b])
+        onsets |= 1u << b;
+    if (softLowBass)
+      onsets |= 1u << A::SOFT_LOW_BASS;
+    bool high = bang[A::HIGHS], uhmid = bang[A::UPPER_HIGH_MIDS], hmid = bang[A::HIGH_MIDS],
+         umid = bang[A::UPPER_MIDS], mid = bang[A::MIDS];
+    if (high && uhmid && hmid && umid)
+      onsets |= 1u << A::ALL_HIGHS;
+    if ((high && uhmid && hmid) || (umid && hmid && uhmid) || (mid && umid && hmid))
+      onsets |= 1u << A::ANY_MIDS;
+    if (bang[A::BASS] && bang[A::LOW_MIDS] && mid)
+      onsets |= 1u << A::LOWS;
+
+    // presence: how many frames between mid onsets, averaged over five
+    bool presenceOnset = (uhmid && hmid) || (umid && hmid);
+    if (mPresenceCount == 0)
+      pushPresence(mClocker);
+    if (presenceOnset)
+    {
+      if (mPresenceCount < 5)
+        pushPresence(mClocker);
+      else if (mClocker > 0)
+        pushPresence(mClocker);
+      mClocker = 0;
+    }
+    else
+      mClocker++;
+    // the js never resets presenceAvg before summing; kept for the same reason
+    for (int i = 0; i < mPresenceCount; i++)
+      mPresenceAvg += mPresence[i];
+    mPresenceAvg /= mPresenceCount;
+    if (mPresenceAvg < 200)
+      mPresenceVal = 3;
+    else if (mPresenceAvg < 450)
+      mPresenceVal = 2;
+    else
+      mPresenceVal = 1;
+    if (presenceOnset)
+      onsets |= 1u << A::PRESENCE;
+    f.presence = mPresenceVal;
+
+    f.volume = sum / A::BANDS;
+    if (f.volume >= 0 && f.volume < 0.2f)
+      mVolumeVal = 0;
+    else if (f.volume >= 0.2f && f.volume < 0.4f)
+      mVolumeVal = 0.5f;
+    else if (f.volume >= 0.4f && f.volume < 0.5f)
+      mVolumeVal = 1;
+    else if (f.volume >= 0.5f && f.volume < 0.56f)
+      mVolumeVal = 1.5f;
+    else if (f.volume >= 0.56f && f.volume < 0.7f)
+      mVolumeVal = 2;
+    f.volumeVal = mVolumeVal;
+    f.onsets = onsets;
+  }
+
+  // the js's unshift/pop arrays: the last three means, newest first
+  struct History
+  {
+    float values[3];
+    int count = 0;
+
+    // an onset needs a full history (in the js the comparison is with
+    // undefined until then, which is false)
+    bool onset(float mean, float threshold) const { return count == 3 && mean - values[2] > threshold; }
+    void push(float mean)
+    {
+      values[2] = values[1];
+      values[1] = values[0];
+      values[0] = mean;
+      if (count < 3)
+        count++;
+    }
+  };
+
+  void pushPresence(int clocker)
+  {
+    for (int i = 4; i > 0; i--)
+      mPresence[i] = mPresence[i - 1];
+    mPresence[0] = clocker;
+    if (mPresenceCount < 5)
+      mPresenceCount++;
+  }
+
+  float mWindow[FFT_SIZE];
+  std::complex<float> mTwiddle[FFT_SIZE / 2];
+  int mReverse[FFT_SIZE];
+  int mBandOf[FFT_SIZE / 2 + 1];
+  float mInput[FFT_SIZE];
+  int mFill = 0;
+  std::complex<float> mSpectrum[FFT_SIZE];
+  float mMeter[METER_SIZE] = {};
+
+  History mHistory[AnalysisFrame::BANDS];
+  int mClocker = 0;
+  int mPresence[5] = {};
+  int mPresenceCount = 0;
+  float mPresenceAvg = 0;
+  int mPresenceVal = 0;
+  float mVolumeVal = 0;
+
+  SpscQueue<AnalysisFrame, 64> mFrames;
+  std::atomic<uint64_t> mFrameCount{0}, mDropped{0};
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+// picks what part of each chunk to draw this frame. a chunk whose box (at the
+// current point of the morph) is outside the view frustum is skipped; one that
+// is on screen draws about pointsPerPixel points per pixel it covers, since
+// more than that land on the same pixels anyway. if the total is still over
+// the point budget every chunk is scaled down to fit. the points of a chunk
+// are stored so that any prefix is spread evenly over it (see
+// CompactImage::chunkOrder), so "fewer points" is just a shorter range.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "al/graphics/al_OpenGL.hpp"
+#include "al/math/al_Mat.hpp"
+
+#include "compact-layouts.hpp"
+
+class ChunkCuller
+{
+public:
+  size_t budget = 1000000;
+  float pointsPerPixel = 1;
+
+  // the ranges for glMultiDrawArrays
+  std::vector<GLint> firsts;
+  std::vector<GLsizei> counts;
+  size_t points = 0; // sum of counts
+
+  // the morph runs from layout fromLayout of level fromLevel of from to
+  // toLayout of toLevel of to, a of the way, with the tint's luminance times
+  // zScale added to z. margin is how far the geometry shader grows a point.
+  // points is how many are drawn at most. the ranges count from the level's
+  // first point
+  void select(const CompactImage &from, const ImageLevel &fromLevel, int fromLayout, const ImageLevel &toLevel,
+              int toLayout, float a, float zScale, float margin, const al::Mat4f &mvp, float viewportWidth,
+              float viewportHeight, size_t points)
+  {
+    firsts.clear();
+    counts.clear();
+    mWanted.clear();
+    this->points = 0;
+    bool sameChunks = fromLevel.width == toLevel.width && fromLevel.height == toLevel.height;
+
+    size_t total = 0;
+    for (size_t c = 0; c < toLevel.chunks.size(); c++)
+    {
+      const PointChunk &chunk = toLevel.chunks[c];
+      if (chunk.first >= points)
+        break;
+      size_t count = std::min<size_t>(chunk.count, points - chunk.first);
+
+      // the box of the blend of two boxes, also for a outside [0, 1]
+      al::Vec3f fromLo, fromHi;
+      if (sameChunks)
+        fromLo = fromLevel.chunks[c].lo[fromLayout], fromHi = fromLevel.chunks[c].hi[fromLayout];
+      else
+      {
+        const CompactLayout &l = from.layouts[fromLayout];
+        fromLo = l.origin;
+        fromHi = l.origin + l.extent;
+      }
+      float lo[3], hi[3];
+      for (int k = 0; k < 3; k++)
+      {
+        float f0 = fromLo[k] * (1 - a), f1 = fromHi[k] * (1 - a);
+        float t0 = chunk.lo[toLayout][k] * a, t1 = chunk.hi[toLayout][k] * a;
+        lo[k] = std::min(f0, f1) + std::min(t0, t1) - margin;
+        hi[k] = std::max(f0, f1) + std::max(t0, t1) + margin;
+      }
+      lo[2] += std::min(zScale, 0.0f);
+      hi[2] += std::max(zScale, 0.0f);
+
+      float area;
+      if (!onScreen(mvp, lo, hi, viewportWidth, viewportHeight, area))
+        continue;
+      size_t wanted = std::min(count, std::max<size_t>(size_t(MIN_POINTS), size_t(std::ceil(area * pointsPerPixel))));
+      firsts.push_back(chunk.first);
+      counts.push_back(count);
+      mWanted.push_back(wanted);
+      total += wanted;
+    }
+
+    double scale = total > budget ? double(budget) / total : 1.0;
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+      size_t n = std::max<size_t>(std::min<size_t>(counts[i], size_t(MIN_POINTS)), size_t(mWanted[i] * scale));
+      counts[i] = std::min<size_t>(counts[i], n);
+      this->points += counts[i];
+    }
+  }
+
+private:
+  // a chunk never drops below this, so it doesn't vanish when far away
+  enum
+  {
+    MIN_POINTS = 16
+  };
+
+  // false if the box is outside the frustum, else the pixels it covers (the
+  // whole viewport if it reaches behind the camera)
+  static bool onScreen(const al::Mat4f &m, const float lo[3], const float hi[3], float width, float height,
+                       float &area)
+  {
+    int outside[6] = {0, 0, 0, 0, 0, 0};
+    float x0 = 1, x1 = -1, y0 = 1, y1 = -1;
+    bool behind = false;
+    for (int corner = 0; corner < 8; corner++)
+    {
+      float p[3] = {corner & 1 ? hi[0] : lo[0], corner & 2 ? hi[1] : lo[1], corner & 4 ? hi[2] : lo[2]};
+      float clip[4];
+      for (int r = 0; r < 4; r++)
+        clip[r] = m(r, 0) * p[0] + m(r, 1) * p[1] + m(r, 2) * p[2] + m(r, 3);
+      float w = clip[3];
+      outside[0] += clip[0] < -w;
+      outside[1] += clip[0] > w;
+      outside[2] += clip[1] < -w;
+      outside[3] += clip[1] > w;
+      outside[4] += clip[2] < -w;
+      outside[5] += clip[2] > w;
+      if (w <= 1e-6f)
+      {
+        behind = true;
+        continue;
+      }
+      x0 = std::min(x0, clip[0] / w), x1 = std::max(x1, clip[0] / w);
+      y0 = std::min(y0, clip[1] / w), y1 = std::max(y1, clip[1] / w);
+    }
+    for (int plane = 0; plane < 6; plane++)
+      if (outside[plane] == 8)
+        return false;
+    if (behind)
+      area = width * height;
+    else
+      area = std::max(std::min(x1, 1.0f) - std::max(x0, -1.0f), 0.0f) * 0.5f * width *
+             std::max(std::min(y1, 1.0f) - std::max(y0, -1.0f), 0.0f) * 0.5f * height;
+    area = std::max(area, 1.0f);
+    return true;
+  }
+
+  std::vector<size_t> mWanted;
+};
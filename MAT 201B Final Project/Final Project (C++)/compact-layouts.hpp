@@ -0,0 +1,305 @@
+#pragma once
+
+// compact storage for the point clouds. a layout keeps its positions as 16 bit
+// fixed point relative to its own bounding box, and an image keeps one set of
+// 8 bit rgba colors shared by all four layouts. that is 6 + 4 bytes a point
+// instead of the 12 + 16 of a float Mesh. the values are expanded only where
+// they are used: by the vertex shader (normalized attributes plus the
+// origin/extent uniforms) or by the CPU morph.
+//
+// the points are not stored in pixel order but tile by tile (32x32 pixel
+// chunks), and inside a tile in an order where every prefix is spread evenly
+// over it. a chunk can then be culled as a whole, or drawn at lower density
+// by drawing only the start of it.
+//
+// an image also keeps a pyramid of itself: the same four layouts built from
+// the picture at half, a quarter and an eighth of the size (box filtered, so
+// the colors are averages, not a sample). the levels are stored one after the
+// other in the same arrays, so all of them are uploaded once and a frame
+// picks the density it draws by where in the buffers it starts.
+//
+// an image loaded from the point cache (point-cache.hpp) doesn't own its
+// arrays: its layouts and colors point into the mapped file, which it keeps
+// open, so nothing is copied and instances share the pages.
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "al/app/al_App.hpp"
+#include "al/math/al_Functions.hpp"
+
+// the four ways an image is laid out as points
+enum LayoutType
+{
+  PIC_LAYOUT,
+  RGB_LAYOUT,
+  HSV_LAYOUT,
+  SOMETHING_ELSE_LAYOUT,
+  LAYOUTS
+};
+
+struct CompactLayout
+{
+  std::vector<uint16_t> xyz;         // 3 per point, unless mapped
+  const uint16_t *mapped = nullptr; // or 3 per point in a mapped cache
+  size_t mappedPoints = 0;
+  // position = origin + xyz / 65535 * extent
+  al::Vec3f origin{0, 0, 0};
+  al::Vec3f extent{1, 1, 1};
+
+  const uint16_t *data() const { return mapped ? mapped : xyz.data(); }
+  size_t points() const { return mapped ? mappedPoints : xyz.size() / 3; }
+  size_t bytes() const { return points() * 3 * sizeof(uint16_t); }
+
+  al::Vec3f position(size_t i) const
+  {
+    const uint16_t *q = data() + 3 * i;
+    return al::Vec3f(origin.x + q[0] * (extent.x / 65535.0f),
+                     origin.y + q[1] * (extent.y / 65535.0f),
+                     origin.z + q[2] * (extent.z / 65535.0f));
+  }
+
+  // expand points first to first + n into separate x, y and z arrays
+  void unpack(float *x, float *y, float *z, size_t first, size_t n) const
+  {
+    const uint16_t *q = data() + 3 * first;
+    for (size_t i = 0; i < n; i++)
+    {
+      x[i] = origin.x + q[3 * i + 0] * (extent.x / 65535.0f);
+      y[i] = origin.y + q[3 * i + 1] * (extent.y / 65535.0f);
+      z[i] = origin.z + q[3 * i + 2] * (extent.z / 65535.0f);
+    }
+  }
+
+  void quantize(const std::vector<al::Vec3f> &positions)
+  {
+    size_t n = positions.size();
+    al::Vec3f lo(0, 0, 0), hi(0, 0, 0);
+    if (n > 0)
+      lo = hi = positions[0];
+    for (auto &p : positions)
+      for (int c = 0; c < 3; c++)
+      {
+        if (p[c] < lo[c])
+          lo[c] = p[c];
+        if (p[c] > hi[c])
+          hi[c] = p[c];
+      }
+    origin = lo;
+    for (int c = 0; c < 3; c++)
+    {
+      extent[c] = hi[c] - lo[c];
+      if (extent[c] <= 0)
+        extent[c] = 1; // flat along this axis, e.g. z of pic
+    }
+
+    mapped = nullptr;
+    xyz.resize(3 * n);
+    for (size_t i = 0; i < n; i++)
+      for (int c = 0; c < 3; c++)
+        xyz[3 * i + c] = uint16_t((positions[i][c] - origin[c]) / extent[c] * 65535.0f + 0.5f);
+  }
+};
+
+// one tile of an image: a contiguous range of points and where they are in
+// each layout
+struct PointChunk
+{
+  uint32_t first = 0, count = 0;
+  al::Vec3f lo[LAYOUTS], hi[LAYOUTS];
+};
+
+// one level of the pyramid: a contiguous range of points in every layout
+// and in the colors, and its chunks (whose firsts count from the level's)
+struct ImageLevel
+{
+  uint32_t first = 0;
+  int width = 0, height = 0;
+  std::vector<PointChunk> chunks;
+
+  size_t points() const { return size_t(width) * height; }
+};
+
+struct CompactImage
+{
+  int width = 0; // of level 0, the image as decoded
+  int height = 0;
+  CompactLayout layouts[LAYOUTS];
+  std::vector<uint8_t> rgba;            // 4 per point, unless mapped
+  const uint8_t *mappedRgba = nullptr;  // or 4 per point in a mapped cache
+  std::shared_ptr<const void> mapping;  // keeps the mapped arrays valid
+  std::vector<ImageLevel> levels;
+
+  enum
+  {
+    CHUNK_SIZE = 32,
+    MAX_LEVELS = 4
+  };
+
+  // of all levels
+  size_t points() const { return pyramidPoints(width, height); }
+
+  // a level that exists: images too small for MAX_LEVELS stop early
+  const ImageLevel &level(int l) const { return levels[std::max(0, std::min(l, int(levels.size()) - 1))]; }
+
+  // level l of a width x height image is ceil(width / 2^l) x ceil(height /
+  // 2^l), down to where it would be smaller than a chunk
+  static int levelCount(int width, int height)
+  {
+    int n = 1;
+    while (n < MAX_LEVELS && std::min(width, height) >= 2 * CHUNK_SIZE)
+    {
+      width = (width + 1) / 2;
+      height = (height + 1) / 2;
+      n++;
+    }
+    return n;
+  }
+
+  static size_t pyramidPoints(int width, int height)
+  {
+    size_t n = 0;
+    for (int l = levelCount(width, height); l > 0; l--)
+    {
+      n += size_t(width) * height;
+      width = (width + 1) / 2;
+      height = (height + 1) / 2;
+    }
+    return n;
+  }
+
+  size_t bytes() const
+  {
+    size_t b = colorBytes();
+    for (auto &l : layouts)
+      b += l.bytes();
+    return b;
+  }
+
+  al::Color color(size_t i) const
+  {
+    const uint8_t *c = colors() + 4 * i;
+    return al::Color(c[0] / 255.0f, c[1] / 255.0f, c[2] / 255.0f, c[3] / 255.0f);
+  }
+
+  // Color::luminance() of every point of a level
+  void luminance(const ImageLevel &level, std::vector<float> &out) const
+  {
+    out.resize(level.points());
+    for (size_t i = 0; i < out.size(); i++)
+      out[i] = color(level.first + i).luminance();
+  }
+
+  const uint8_t *colors() const { return mappedRgba ? mappedRgba : rgba.data(); }
+  size_t colorBytes() const { return mappedRgba ? 4 * points() : rgba.size(); }
+
+  void pack(const std::vector<al::Color> &colors)
+  {
+    mappedRgba = nullptr;
+    rgba.resize(4 * colors.size());
+    for (size_t i = 0; i < colors.size(); i++)
+    {
+      const al::Color &c = colors[i];
+      rgba[4 * i + 0] = uint8_t(al::clip(c.r) * 255.0f + 0.5f);
+      rgba[4 * i + 1] = uint8_t(al::clip(c.g) * 255.0f + 0.5f);
+      rgba[4 * i + 2] = uint8_t(al::clip(c.b) * 255.0f + 0.5f);
+      rgba[4 * i + 3] = uint8_t(al::clip(c.a) * 255.0f + 0.5f);
+    }
+  }
+
+  // the pixel (row * width + column) each point comes from: tiles in row
+  // order, and inside a tile the pixels by bit reversed Morton code, so the
+  // first 4, 16, 64... points of a tile are a regular grid over it
+  static void chunkOrder(int width, int height, std::vector<uint32_t> &order)
+  {
+    order.clear();
+    order.reserve(size_t(width) * height);
+    const int bits = 10; // log2(CHUNK_SIZE * CHUNK_SIZE)
+    for (int ty = 0; ty < height; ty += CHUNK_SIZE)
+      for (int tx = 0; tx < width; tx += CHUNK_SIZE)
+        for (uint32_t i = 0; i < CHUNK_SIZE * CHUNK_SIZE; i++)
+        {
+          uint32_t m = 0;
+          for (int b = 0; b < bits; b++)
+            m |= ((i >> b) & 1) << (bits - 1 - b);
+          int x = 0, y = 0;
+          for (int b = 0; b < bits / 2; b++)
+          {
+            x |= ((m >> (2 * b)) & 1) << b;
+            y |= ((m >> (2 * b + 1)) & 1) << b;
+          }
+          if (tx + x < width && ty + y < height)
+            order.push_back(uint32_t(ty + y) * width + tx + x);
+        }
+  }
+
+  // the levels, their chunk ranges and the chunks' bounds in every layout,
+  // from width, height and the positions
+  void findLevels()
+  {
+    levels.clear();
+    int w = width, h = height;
+    uint32_t first = 0;
+    for (int l = levelCount(width, height); l > 0; l--)
+    {
+      ImageLevel level;
+      level.first = first;
+      level.width = w;
+      level.height = h;
+      findChunks(level);
+      levels.push_back(std::move(level));
+      first += uint32_t(size_t(w) * h);
+      w = (w + 1) / 2;
+      h = (h + 1) / 2;
+    }
+  }
+
+  void findChunks(ImageLevel &level) const
+  {
+    uint32_t first = 0;
+    for (int ty = 0; ty < level.height; ty += CHUNK_SIZE)
+      for (int tx = 0; tx < level.width; tx += CHUNK_SIZE)
+      {
+        PointChunk c;
+        c.first = first;
+        c.count = std::min<int>(CHUNK_SIZE, level.width - tx) * std::min<int>(CHUNK_SIZE, level.height - ty);
+        first += c.count;
+        for (int l = 0; l < LAYOUTS; l++)
+        {
+          const CompactLayout &layout = layouts[l];
+          if (layout.points() < level.first + first)
+            continue;
+          uint16_t lo[3] = {65535, 65535, 65535}, hi[3] = {0, 0, 0};
+          for (uint32_t i = level.first + c.first; i < level.first + first; i++)
+            for (int k = 0; k < 3; k++)
+            {
+              lo[k] = std::min(lo[k], layout.data()[3 * i + k]);
+              hi[k] = std::max(hi[k], layout.data()[3 * i + k]);
+            }
+          for (int k = 0; k < 3; k++)
+          {
+            c.lo[l][k] = layout.origin[k] + lo[k] * (layout.extent[k] / 65535.0f);
+            c.hi[l][k] = layout.origin[k] + hi[k] * (layout.extent[k] / 65535.0f);
+          }
+        }
+        level.chunks.push_back(c);
+      }
+  }
+
+  // what the same image cost as float meshes: pic, rgb, hsv, somethingElse
+  // and its current[] copy, each with float3 positions and float4 colors
+  static size_t floatMeshBytes(size_t points)
+  {
+    return 5 * points * (sizeof(al::Vec3f) + sizeof(al::Color));
+  }
+};
+
+// names one layout of one image. the app morphs between two of these, so
+// switching image or layout copies two ints instead of any point data
+struct LayoutHandle
+{
+  int image = 0;
+  int layout = PIC_LAYOUT;
+};
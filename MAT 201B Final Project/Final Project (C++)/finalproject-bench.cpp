@@ -0,0 +1,341 @@
+// finalproject without a performer: loads the images, plays a scripted
+// sequence of /picType, /meshType and /interpVal, times every frame's phases
+// and writes the results, then quits.
+//
+//   finalproject-bench [image directory|-] [script|-] [output prefix]
+//
+// writes <prefix>.json (percentiles per phase, per image loads) and
+// <prefix>.csv (one row per frame); the prefix defaults to "bench". to run
+// it without a display, use a software GL under a virtual one, e.g.
+//   LIBGL_ALWAYS_SOFTWARE=1 xvfb-run ./finalproject-bench
+//
+// a script has one command per line, "<frame> <command> <value>", where the
+// command is picType, meshType, interpVal, zScale, gpuMorph, pointSprites,
+// pointSize, level or distance (of the camera from the image), and a last
+// line "<frame> end". without one, every image is shown for 30 frames each,
+// cycling the layouts, in seven passes: the GPU morph with geometry shader
+// quads and with sprites, at the default point size (about a pixel, so mostly
+// vertex work), at 10x (mostly fragment work) and zoomed in on splats too big
+// for a sprite (see point-vertex.glsl), and then the CPU morph. each pair of
+// passes morphs the same layouts. the json has the frame and draw times and
+// the points drawn per second for each of these, and the fraction of the
+// window they cover, from the depth buffer every 30th frame: where the
+// sprites' coverage falls short of the quads', their limits show.
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#define FINALPROJECT_NO_MAIN
+#include "finalproject.cpp"
+
+struct ScriptStep
+{
+  int frame;
+  string command;
+  float value;
+};
+
+struct FrameSample
+{
+  int picture, layout;
+  bool gpu, sprites;
+  float pointSize, distance;
+  double update, morph, draw, frame;
+  size_t points;
+  double coverage; // of the window, or -1 when not measured
+};
+
+class BenchApp : public MyApp
+{
+public:
+  vector<ScriptStep> script;
+  int lastFrame = 0;
+  string output = "bench";
+  float distance = 3.5f; // of the camera from the image, as MyApp starts
+
+  BenchApp()
+  {
+    listening = false; // the script is the queue's producer
+    pointSize.max(5); // past the GUI's, for the zoomed-in passes
+  }
+
+  void defaultScript()
+  {
+    // gpuMorph, pointSprites, pointSize, distance
+    float passes[7][4] = {{1, 0, 0.15f, 3.5f}, {1, 1, 0.15f, 3.5f}, {1, 0, 1.5f, 3.5f}, {1, 1, 1.5f, 3.5f},
+                          {1, 0, 5, 0.8f},     {1, 1, 5, 0.8f},     {0, 0, 0.15f, 3.5f}};
+    int f = 0;
+    for (int pass = 0; pass < 7; pass++)
+    {
+      script.push_back({f, "gpuMorph", passes[pass][0]});
+      script.push_back({f, "pointSprites", passes[pass][1]});
+      script.push_back({f, "pointSize", passes[pass][2]});
+      script.push_back({f, "distance", passes[pass][3]});
+      for (int p = 0; p < pics; p++, f += 30)
+      {
+        script.push_back({f, "picType", float(p)});
+        script.push_back({f, "meshType", float(1 + (p + pass / 2) % 4)});
+        script.push_back({f, "interpVal", 1});
+      }
+    }
+    lastFrame = f;
+  }
+
+  bool readScript(const string &file)
+  {
+    ifstream in(file);
+    string line;
+    while (getline(in, line))
+    {
+      istringstream words(line);
+      ScriptStep step{0, "", 0};
+      if (!(words >> step.frame >> step.command))
+        continue;
+      if (step.command == "end")
+      {
+        lastFrame = step.frame;
+        continue;
+      }
+      words >> step.value;
+      script.push_back(step);
+    }
+    stable_sort(script.begin(), script.end(),
+                [](const ScriptStep &a, const ScriptStep &b) { return a.frame < b.frame; });
+    if (lastFrame == 0 && !script.empty())
+      lastFrame = script.back().frame + 60;
+    return !script.empty();
+  }
+
+  void onCreate() override
+  {
+    MyApp::onCreate();
+    if (script.empty())
+      defaultScript();
+    samples.reserve(lastFrame);
+    started = chrono::steady_clock::now();
+  }
+
+  void onAnimate(double) override
+  {
+    frameStart = chrono::steady_clock::now();
+    // scripted steps go through the queue OSC would, from this thread
+    // alone: onMessage drops what the network sends
+    for (; next < script.size() && script[next].frame <= frame; next++)
+    {
+      const ScriptStep &s = script[next];
+      if (s.command == "picType")
+        oscCommands.push({OscCommand::PIC_TYPE, int(s.value)});
+      else if (s.command == "meshType")
+        oscCommands.push({OscCommand::MESH_TYPE, int(s.value)});
+      else if (s.command == "interpVal")
+        oscCommands.push({OscCommand::INTERP_VAL, 0, s.value});
+      else if (s.command == "zScale")
+        zScale = s.value;
+      else if (s.command == "gpuMorph")
+        gpuMorph = s.value;
+      else if (s.command == "pointSprites")
+        pointSprites = s.value;
+      else if (s.command == "pointSize")
+        pointSize = s.value;
+      else if (s.command == "level")
+        level = int(s.value);
+      else if (s.command == "distance")
+      {
+        distance = s.value;
+        nav().pos(0.5, 0.5, distance);
+      }
+    }
+    // a fixed step, so runs of the same script morph the same way
+    MyApp::onAnimate(1 / 60.0);
+  }
+
+  void onDraw(Graphics &g) override
+  {
+    auto t0 = chrono::steady_clock::now();
+    MyApp::onDraw(g);
+    glFinish(); // count the GPU's work too
+    auto t1 = chrono::steady_clock::now();
+
+    samples.push_back({k, actual.layout, bool(gpuMorph), bool(pointSprites), pointSize, distance, times.update,
+                       times.morph, chrono::duration<double>(t1 - t0).count(),
+                       chrono::duration<double>(t1 - frameStart).count(), times.points,
+                       frame % 30 == 29 ? coverage() : -1});
+    if (++frame >= lastFrame)
+    {
+      write();
+      quit();
+    }
+  }
+
+private:
+  // the fraction of the window the points were drawn on: what the depth
+  // buffer has something nearer than the far plane for. after the timing
+  double coverage()
+  {
+    depths.resize(size_t(fbWidth()) * fbHeight());
+    glReadPixels(0, 0, fbWidth(), fbHeight(), GL_DEPTH_COMPONENT, GL_FLOAT, depths.data());
+    size_t covered = count_if(depths.begin(), depths.end(), [](float d) { return d < 1; });
+    return depths.empty() ? 0 : double(covered) / depths.size();
+  }
+
+  struct Summary
+  {
+    double p50 = 0, p90 = 0, p99 = 0, max = 0, mean = 0;
+  };
+
+  // nearest rank, in milliseconds
+  static Summary summarize(vector<double> v)
+  {
+    Summary s;
+    if (v.empty())
+      return s;
+    sort(v.begin(), v.end());
+    auto rank = [&](double p) { return v[min(v.size() - 1, size_t(p * v.size()))] * 1000; };
+    s.p50 = rank(0.5);
+    s.p90 = rank(0.9);
+    s.p99 = rank(0.99);
+    s.max = v.back() * 1000;
+    for (double x : v)
+      s.mean += x;
+    s.mean = s.mean / v.size() * 1000;
+    return s;
+  }
+
+  static void json(ostream &o, const char *name, const Summary &s, bool last = false)
+  {
+    o << "    \"" << name << "\": {\"p50\": " << s.p50 << ", \"p90\": " << s.p90 << ", \"p99\": " << s.p99
+      << ", \"max\": " << s.max << ", \"mean\": " << s.mean << "}" << (last ? "\n" : ",\n");
+  }
+
+  // e.g. "gpu_sprites_0.15", or "gpu_sprites_5_at_0.8" closer than MyApp starts
+  static string config(const FrameSample &s)
+  {
+    ostringstream o;
+    o << (s.gpu ? "gpu" : "cpu") << (s.sprites ? "_sprites_" : "_geometry_") << s.pointSize;
+    if (s.distance != 3.5f)
+      o << "_at_" << s.distance;
+    return o.str();
+  }
+
+  void write()
+  {
+    vector<double> update, morph, draw, whole, decode, build, upload;
+    // per configuration, in the order they first appear
+    vector<string> configs;
+    vector<vector<double>> configFrames, configDraws, configCoverage;
+    vector<double> configPoints;
+    for (auto &s : samples)
+    {
+      update.push_back(s.update);
+      if (!s.gpu)
+        morph.push_back(s.morph);
+      draw.push_back(s.draw);
+      whole.push_back(s.frame);
+      string name = config(s);
+      size_t c = find(configs.begin(), configs.end(), name) - configs.begin();
+      if (c == configs.size())
+      {
+        configs.push_back(name);
+        configFrames.emplace_back();
+        configDraws.emplace_back();
+        configCoverage.emplace_back();
+        configPoints.push_back(0);
+      }
+      configFrames[c].push_back(s.frame);
+      configDraws[c].push_back(s.draw);
+      if (s.coverage >= 0)
+        configCoverage[c].push_back(s.coverage);
+      configPoints[c] += s.points;
+    }
+    int cached = 0;
+    for (auto &l : library.loads())
+    {
+      cached += l.cached;
+      if (!l.cached)
+        decode.push_back(l.decode);
+      build.push_back(l.build);
+      upload.push_back(l.upload);
+    }
+
+    ofstream j(output + ".json");
+    j << "{\n  \"frames\": " << samples.size() << ",\n  \"images\": " << pics << ",\n  \"seconds\": "
+      << chrono::duration<double>(chrono::steady_clock::now() - started).count() << ",\n";
+    j << "  \"frame_ms\": {\n";
+    json(j, "all", summarize(whole), configs.empty());
+    for (size_t c = 0; c < configs.size(); c++)
+      json(j, configs[c].c_str(), summarize(configFrames[c]), c + 1 == configs.size());
+    j << "  },\n  \"draw_ms\": {\n";
+    for (size_t c = 0; c < configs.size(); c++)
+      json(j, configs[c].c_str(), summarize(configDraws[c]), c + 1 == configs.size());
+    j << "  },\n  \"draw_mpoints_per_s\": {\n";
+    for (size_t c = 0; c < configs.size(); c++)
+    {
+      double seconds = 0;
+      for (double d : configDraws[c])
+        seconds += d;
+      j << "    \"" << configs[c] << "\": " << (seconds > 0 ? configPoints[c] / seconds / 1e6 : 0)
+        << (c + 1 == configs.size() ? "\n" : ",\n");
+    }
+    j << "  },\n  \"coverage\": {\n";
+    bool first = true;
+    for (size_t c = 0; c < configs.size(); c++)
+    {
+      if (configCoverage[c].empty())
+        continue;
+      double mean = 0;
+      for (double x : configCoverage[c])
+        mean += x;
+      j << (first ? "" : ",\n") << "    \"" << configs[c] << "\": " << mean / configCoverage[c].size();
+      first = false;
+    }
+    j << (first ? "" : "\n");
+    j << "  },\n  \"phase_ms\": {\n";
+    json(j, "update", summarize(update));
+    json(j, "morph", summarize(morph));
+    json(j, "draw", summarize(draw), true);
+    j << "  },\n  \"load_ms\": {\n    \"loads\": " << library.loads().size() << ",\n    \"cached\": " << cached << ",\n";
+    json(j, "decode", summarize(decode));
+    json(j, "build", summarize(build));
+    json(j, "upload", summarize(upload), true);
+    j << "  }\n}\n";
+
+    ofstream c(output + ".csv");
+    c << "frame,picture,layout,gpu_morph,sprites,point_size,distance,update_ms,morph_ms,draw_ms,frame_ms,points,"
+         "coverage\n";
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+      auto &s = samples[i];
+      c << i << "," << s.picture << "," << s.layout << "," << s.gpu << "," << s.sprites << "," << s.pointSize << ","
+        << s.distance << "," << s.update * 1000 << "," << s.morph * 1000 << "," << s.draw * 1000 << ","
+        << s.frame * 1000 << "," << s.points << ",";
+      if (s.coverage >= 0)
+        c << s.coverage;
+      c << "\n";
+    }
+    cout << "wrote " << output << ".json and " << output << ".csv (" << samples.size() << " frames)" << endl;
+  }
+
+  vector<FrameSample> samples;
+  vector<float> depths; // coverage()'s
+  size_t next = 0;
+  int frame = 0;
+  chrono::steady_clock::time_point started, frameStart;
+};
+
+int main(int argc, char *argv[])
+{
+  BenchApp app;
+  if (argc > 1 && string(argv[1]) != "-")
+    app.imageDirectory = argv[1];
+  if (argc > 2 && string(argv[2]) != "-" && !app.readScript(argv[2]))
+  {
+    cout << "no steps in " << argv[2] << endl;
+    return 1;
+  }
+  if (argc > 3)
+    app.output = argv[3];
+  // the morph and draw are what is measured, not the display
+  app.fps(1000);
+  app.start();
+}
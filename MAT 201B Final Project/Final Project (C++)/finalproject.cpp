@@ -7,6 +7,7 @@ smooth.  This is because interpolation is done on the GPU.
 */
 
 #include <cassert>
+#include <chrono>
 #include <cstdint>
 #include <iostream>
 #include <vector>
@@ -15,27 +16,131 @@ smooth.  This is because interpolation is done on the GPU.
 #include "al/graphics/al_Image.hpp"
 #include "al/app/al_GUIDomain.hpp"
 
+#include "../../common/frame-profiler.hpp"
+#include "../../common/stream-buffer.hpp"
+
+#include "audio-analysis.hpp"
+#include "chunk-culling.hpp"
+#include "image-library.hpp"
+#include "morph-kernel.hpp"
+#include "osc-commands.hpp"
+#include "osc-trace.hpp"
+
 using namespace al;
 using namespace std;
 
 string slurp(string fileName); // forward declaration
+string define(string source, string name);
+
+// /meshType number -> layout
+int meshTypeLayout(int meshType)
+{
+  switch (meshType)
+  {
+  case 1:
+    return PIC_LAYOUT;
+  case 2:
+    return SOMETHING_ELSE_LAYOUT;
+  case 3:
+    return HSV_LAYOUT;
+  case 4:
+    return RGB_LAYOUT;
+  default:
+    return -1;
+  }
+}
 
 class MyApp : public App
 {
 public:
+  // the images come from a directory (or the 14 below), and at most
+  // residentImages of them are in memory at once, each as four compact
+  // layouts in RAM and on the GPU. any size works: they are decoded to at
+  // most maxSide pixels on a side
+  string imageDirectory;
+  int residentImages = 16;
+  int maxSide = 500;
+  ImageLibrary library;
   int pics = 14;
-  Mesh pic[14], rgb[14], hsv[14], somethingElse[14];
-  Mesh actual, previous, current[14];
-  HSV hueSatVal[14];
-  Color col[14];
+  // the morph runs from previous to actual, both by handle into the library;
+  // the slots are looked up once a frame in onAnimate
+  LayoutHandle actual, previous;
+  ImageLibrary::Slot *fromSlot = nullptr, *toSlot = nullptr, *tintSlot = nullptr;
+  bool shown = false;
+  // only the CPU morph needs floats: the morphed positions of image k, which
+  // the morph writes straight into GPU memory (see common/stream-buffer.hpp),
+  // and the endpoints and luminance it is computed from, expanded once per
+  // switch. the colors are image k's own buffer on the GPU
+  StreamBuffer current;
+  size_t currentBase = 0, currentPoints = 0; // this frame's, in current
+  GLint currentColorOffset = 0;              // its first point in the colors
+  int currentColors = -1;                    // which image's luminance luminance holds
+  MorphSoA fromSoA, toSoA;
+  LayoutHandle fromExpanded{-1, -1}, toExpanded{-1, -1};
+  int expandedLevel = -1;
+  vector<float> luminance;
+  ThreadPool morphPool;
+
+  // the Max patch's "Random Image" mode draws from an urn; the images not
+  // drawn yet this round are the likely next /picType
+  vector<bool> drawn;
+  int predictedFor = -1; // the k whose next images are queued
+
+  // point-vertex.glsl does the morph, of the chunks that are on screen
+  MorphDraw morphDraw;
+  ChunkCuller culler;
 
   Parameter zScale{"zScale", 1.0, 0.00, 10.0};
   Parameter pointSize{"pointSize", "", 0.15, "", 0.01, 0.5};
   Parameter rotation{"rotation", 0, -35.0, 35.0};
+  // off = old CPU morph of current, e.g. for software GL
+  ParameterBool gpuMorph{"gpuMorph", "", 1.0};
+  // draw the points as sprites instead of geometry shader quads
+  ParameterBool pointSprites{"pointSprites", "", 0.0};
+  // frustum culling and level of detail for the GPU morph
+  ParameterBool culling{"culling", "", 1.0};
+  Parameter pointBudget{"pointBudget", "", 1000000, "", 10000, 4000000};
+  Parameter pointsPerPixel{"pointsPerPixel", "", 1.0, "", 0.1, 8.0};
+  // which level of the image pyramids is drawn: 0 is every pixel, each one
+  // up has a quarter of the points, with their colors averaged
+  ParameterInt level{"level", "", 0, 0, CompactImage::MAX_LEVELS - 1};
   // switch to parameter OSC
 
   const char *filename[14];
-  Image imageData[14];
+  // written by the OSC thread, applied by the graphics thread
+  OscCommandQueue oscCommands;
+  vector<OscCommand> commands;
+  // --record writes every command to a trace, --replay plays one back
+  // instead of listening; either way each command is timed from arrival to
+  // the end of the frame that applied it
+  string recordPath, replayPath;
+  float replaySpeed = 1;
+  // the queue has one producer: the OSC thread, unless a replay or the
+  // bench's script feeds it instead, and the network is ignored
+  bool listening = true;
+  OscRecorder oscRecorder;
+  OscReplayer oscReplayer;
+  vector<OscCommand> applied; // this frame's, for the latency histogram
+  LatencyHistogram latency;
+
+  // the Max analysis, run in onSound; with audioReactive on, its onsets
+  // drive the show directly instead of coming back over OSC
+  AudioAnalysis analysis;
+  double analysisRate = 0; // audio thread only
+  ParameterBool audioReactive{"audioReactive", "", 0.0};
+  double lastMeshOnset = -1;
+  double showTime = 0;
+
+  // how long this frame's library update (loads and uploads) and CPU morph
+  // took, in seconds; finalproject-bench reads them
+  struct
+  {
+    double update = 0, morph = 0;
+    size_t points = 0; // drawn
+  } times;
+
+  bool startupReported = false;
+  bool firstFrameReported = false;
   int k = 0;
   // the current mesh
 
@@ -44,6 +149,11 @@ public:
   float iVal = 1.0;
 
   ShaderProgram pointShader;
+  // the same shaders without the geometry stage, see point-vertex.glsl
+  ShaderProgram spriteShader;
+  float maxPointSize = 64; // pixels, the biggest sprite the GL draws
+
+  ProfilerPanel profilerPanel;
 
   //double rotation{0};
 
@@ -54,6 +164,16 @@ public:
     gui.add(zScale);
     gui.add(pointSize);
     gui.add(rotation);
+    gui.add(gpuMorph);
+    gui.add(pointSprites);
+    gui.add(audioReactive);
+    gui.add(culling);
+    gui.add(pointBudget);
+    gui.add(pointsPerPixel);
+    gui.add(level);
+    // how long each part of a frame takes, see common/frame-profiler.hpp
+    profilerPanel.add(*GUIdomain, {"onAnimate", "applyCommands", "update", "upload", "morph", "onDraw", "cull",
+                                   "onMessage", "load", "build"});
     parameterServer() << zScale;
     parameterServer() << rotation;
   }
@@ -71,6 +191,15 @@ public:
       cout << "shader didn't compile" << endl;
       exit(1);
     }
+    if (!spriteShader.compile(define(slurp("../point-vertex.glsl"), "POINT_SPRITES"),
+                              define(slurp("../point-fragment.glsl"), "POINT_SPRITES")))
+    {
+      cout << "sprite shader didn't compile" << endl;
+      exit(1);
+    }
+    float pointSizes[2] = {1, maxPointSize};
+    glGetFloatv(GL_POINT_SIZE_RANGE, pointSizes);
+    maxPointSize = pointSizes[1];
     filename[0] = "monstrous500.jpeg";
     filename[1] = "zaborsky500.jpeg";
     filename[2] = "lightoftheworld500.jpeg";
@@ -86,134 +215,273 @@ public:
     filename[12] = "urgency500.jpeg";
     filename[13] = "soilflow500.jpeg";
 
-    for (int p = 0; p < pics; p++)
+    // make points like assignment 2
+    // can Ribbonize with LINES
+    // check out tangle-mesh.cpp
+    // LINE_STRIP looks terrible
+
+    vector<string> files(filename, filename + 14);
+    if (!imageDirectory.empty())
+      files = ImageLibrary::scan(imageDirectory);
+    if (files.empty())
     {
-      imageData[p] = Image(filename[p]);
-      if (imageData[p].array().size() == 0)
-      {
-        cout << "failed to load image " << p << endl;
-        //exit(1);
-      }
-      cout << "loaded image size: " << imageData[p].width() << ", " << imageData[p].height() << endl;
-      int W = imageData[p].width();
-      cout << W << endl;
-      int H = imageData[p].height();
-      cout << H << endl;
-
-      pic[p].primitive(Mesh::POINTS);
-      rgb[p].primitive(Mesh::POINTS);
-      hsv[p].primitive(Mesh::POINTS);
-      somethingElse[p].primitive(Mesh::POINTS);
-
-      // make points like assignment 2
-      // can Ribbonize with LINES
-      // check out tangle-mesh.cpp
-      // LINE_STRIP looks terrible
-
-      actual.primitive(Mesh::POINTS);
-      previous.primitive(Mesh::POINTS);
-      for (int b = 0; b < pics; b++)
-      {
-        current[b].primitive(Mesh::POINTS);
-      }
+      cout << "no images in " << imageDirectory << endl;
+      exit(1);
+    }
+    pics = files.size();
+    drawn.assign(pics, false);
+
+    // decode and build the layouts on every core; onAnimate picks up each
+    // image as soon as it is done, so the show starts with the first one.
+    // layouts are cached in pointcache/ after the first run
+    library.open(files, residentImages, "pointcache", maxSide);
+    nav().pos(0.5, 0.5, 3.5);
 
-      // iterate through all the pixel, scanning each row
-      for (int row = 0; row < H; row++)
+    if (!recordPath.empty() && !oscRecorder.open(recordPath))
+      cout << "can't record to " << recordPath << endl;
+    if (!replayPath.empty())
+    {
+      if (!oscReplayer.open(replayPath))
       {
-        for (int column = 0; column < W; column++)
-        {
-          auto pixel = imageData[p].at(column, H - row - 1);
-          pic[p].vertex(1.0 * column / W, 1.0 * row / H, 0.0);
-          pic[p].color(pixel.r / 255.0, pixel.g / 255.0, pixel.b / 255.0);
+        cout << "can't replay " << replayPath << endl;
+        exit(1);
+      }
+      cout << "replaying " << oscReplayer.size() << " commands at " << replaySpeed << "x" << endl;
+      oscReplayer.start(oscCommands, replaySpeed);
+    }
+  }
 
-          rgb[p].vertex((-1.0 * pixel.r / 255.0) + 1.0, pixel.g / 255.0, pixel.b / 255.0);
-          rgb[p].color(pixel.r / 255.0, pixel.g / 255.0, pixel.b / 255.0);
+  // queue what /picType is likely to ask for next: the neighbors (manual
+  // stepping) and then the images still in the random urn, as many as fit
+  // next to the three that are on screen
+  void predict()
+  {
+    int now = k;
+    if (now == predictedFor)
+      return;
+    predictedFor = now;
 
-          col[p].r = pixel.r / 255.0;
-          col[p].g = pixel.g / 255.0;
-          col[p].b = pixel.b / 255.0;
+    drawn[now] = true;
+    if (find(drawn.begin(), drawn.end(), false) == drawn.end())
+    {
+      drawn.assign(pics, false);
+      drawn[now] = true;
+    }
 
-          hueSatVal[p].operator=(col[p]);
-          //hueSatVal.s = p, hueSatVal.h = azimuth, hueSatVal.v = height; multiply azimuth by twopi
-          hsv[p].vertex(((hueSatVal[p].s * cos(hueSatVal[p].h * M_2PI)) / 2.0) + 0.5, (hueSatVal[p].v * 1.1), ((hueSatVal[p].s * sin(hueSatVal[p].h * M_2PI))) / 2.0);
-          hsv[p].color(hueSatVal[p]);
+    vector<int> next = {(now + 1) % pics, (now + pics - 1) % pics};
+    for (int i = 1; i < pics; i++)
+      if (!drawn[(now + i) % pics])
+        next.push_back((now + i) % pics);
 
-          somethingElse[p].vertex(1.0 * column / W, 1.0 * row / H, (pixel.b / 255.0) * 2.0);
-          somethingElse[p].color(pixel.r / 255.0, pixel.g / 255.0, pixel.b / 255.0);
-        }
-      }
-    }
-    actual = pic[0];
-    current[0] = actual;
-    for (int b = 1; b < pics; b++)
+    library.cancelPrefetches();
+    vector<bool> queued(pics, false);
+    int budget = library.capacity() - 3;
+    for (int p : next)
     {
-      current[b] = pic[b];
+      if (budget <= 0)
+        break;
+      if (queued[p] || p == now)
+        continue;
+      queued[p] = true;
+      library.prefetch(p);
+      budget--;
     }
-    previous = actual;
-    nav().pos(0.5, 0.5, 3.5);
   }
 
   float t = 0;
   void onAnimate(double dt) override
   {
+    PROFILE_FRAME();
+    profilerPanel.update();
+    PROFILE("onAnimate");
+    showTime += dt;
+    applyCommands();
+    applyAnalysis();
+    auto t0 = chrono::steady_clock::now();
+    {
+      PROFILE("update");
+      library.update();
+    }
+    times.update = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    times.morph = 0;
+    times.points = 0;
+    predict();
+
+    // whichever image is on screen gets shown as soon as it exists
+    if (!shown && library.resident(k))
+    {
+      actual.image = k;
+      actual.layout = PIC_LAYOUT;
+      previous = actual;
+      shown = true;
+    }
+    // these stay resident while they are in use
+    tintSlot = library.use(k);
+    fromSlot = library.use(previous.image);
+    toSlot = library.use(actual.image);
+
+    if (!startupReported && shown && library.idle())
+    {
+      startupReported = true;
+      cout << library.residentCount() << " of " << pics << " images resident after " << library.elapsed() * 1000
+           << " ms, " << library.residentBytes() / (1024 * 1024) << " MB compact" << endl;
+    }
+
     // = angle + 0.1;
     t = dt + t;
-    for (int i = 0; i < (current[k].vertices().size()); i++)
-    {
-      current[k].vertices()[i] = (previous.vertices()[i] * (1 - (t * iVal) / 2.0)) + (actual.vertices()[i] * (t * iVal) / 2.0);
-      // crashes cause all different sizes
-      current[k].vertices()[i].z += (current[k].colors()[i].luminance() * zScale);
+    if (gpuMorph)
+      return; // point-vertex.glsl does the work
 
-      // current[k].colors()[i].luminance()
+    // layouts that are still loading have no vertices yet
+    currentPoints = 0;
+    if (!fromSlot || !toSlot || !tintSlot)
+      return;
+    const CompactLayout &from = fromSlot->data.layouts[previous.layout];
+    const CompactLayout &to = toSlot->data.layouts[actual.layout];
+    const CompactImage &tint = tintSlot->data;
+    const ImageLevel &fromLevel = fromSlot->data.level(level), &toLevel = toSlot->data.level(level),
+                     &tintLevel = tint.level(level);
+    size_t n = min(tintLevel.points(), min(fromLevel.points(), toLevel.points()));
+    if (n == 0)
+      return;
+    if (expandedLevel != level)
+    {
+      // everything below was expanded from another level
+      currentColors = -1;
+      fromExpanded = toExpanded = LayoutHandle{-1, -1};
+      expandedLevel = level;
+    }
+    if (currentColors != tintSlot->image)
+    {
+      // expand image k's luminance once, not every frame
+      tint.luminance(tintLevel, luminance);
+      currentColors = tintSlot->image;
     }
+    if (fromExpanded.image != previous.image || fromExpanded.layout != previous.layout)
+    {
+      fromSoA.resize(fromLevel.points());
+      from.unpack(fromSoA.x.data(), fromSoA.y.data(), fromSoA.z.data(), fromLevel.first, fromLevel.points());
+      fromExpanded = previous;
+    }
+    if (toExpanded.image != actual.image || toExpanded.layout != actual.layout)
+    {
+      toSoA.resize(toLevel.points());
+      to.unpack(toSoA.x.data(), toSoA.y.data(), toSoA.z.data(), toLevel.first, toLevel.points());
+      toExpanded = actual;
+    }
+    // crashes cause all different sizes (n is the smallest)
+    t0 = chrono::steady_clock::now();
+    PROFILE("morph");
+    if (current.capacity() < n * sizeof(Vec3f))
+      current.create(n * sizeof(Vec3f));
+    float *out = (float *)current.begin();
+    morph(morphPool, fromSoA, toSoA, luminance.data(), (t * iVal) / 2.0, zScale, out, n);
+    current.written(0, n * sizeof(Vec3f));
+    currentBase = current.end();
+    currentPoints = n;
+    currentColorOffset = tintLevel.first;
+    times.morph = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
   }
 
   void onMessage(osc::Message &m) override
   {
-    if (m.addressPattern() == "/picType")
+    PROFILE("onMessage");
+    OscCommand c;
+    if (!listening || !replayPath.empty() || !OscCommandQueue::parse(m, c))
+      return;
+    oscRecorder.write(c);
+    oscCommands.push(c);
+  }
+
+  // graphics thread: what the OSC thread received since last frame
+  void applyCommands()
+  {
+    PROFILE("applyCommands");
+    oscCommands.drain(commands);
+    for (auto &c : commands)
+      apply(c);
+  }
+
+  // graphics thread: every analysis frame since last frame (about 1.5 at
+  // 60 fps), turned into the commands the patch would have sent
+  void applyAnalysis()
+  {
+    AnalysisFrame f;
+    while (analysis.poll(f))
     {
-      m >> k;
-      t = 0;
+      if (!audioReactive)
+        continue;
+      // like the patch: low onsets pick a new image from the urn, mid onsets
+      // at least 200 ms apart a new layout, presence sets the morph speed
+      // and the volume class the z displacement
+      if (f.onset(AnalysisFrame::LOWS))
+      {
+        vector<int> undrawn;
+        for (int p = 0; p < pics; p++)
+          if (!drawn[p])
+            undrawn.push_back(p);
+        if (!undrawn.empty())
+          apply({OscCommand::PIC_TYPE, undrawn[rand() % undrawn.size()]});
+      }
+      if (f.onset(AnalysisFrame::ANY_MIDS) && showTime - lastMeshOnset > 0.2)
+      {
+        lastMeshOnset = showTime;
+        apply({OscCommand::MESH_TYPE, 1 + rand() % 4});
+      }
+      if (f.onset(AnalysisFrame::PRESENCE))
+        apply({OscCommand::INTERP_VAL, 0, float(f.presence)});
+      zScale = f.volumeVal;
     }
-    if (m.addressPattern() == "/meshType")
+  }
+
+  void apply(const OscCommand &c)
+  {
+    if (c.arrival)
+      applied.push_back(c);
+    switch (c.type)
     {
-      m >> meshType;
-      switch (meshType)
+    case OscCommand::PIC_TYPE:
+      k = ((c.i % pics) + pics) % pics;
+      t = 0;
+      break;
+    case OscCommand::MESH_TYPE:
+      meshType = c.i;
+      if (meshTypeLayout(meshType) >= 0)
       {
-      case 1:
-        previous = actual;
-        actual = pic[k];
-        t = 0;
-        break;
-      case 4:
+        // the morph source is whatever was the target, by handle
         previous = actual;
-        actual = rgb[k];
+        actual.image = k;
+        actual.layout = meshTypeLayout(meshType);
         t = 0;
-        break;
-      case 3:
-        previous = actual;
-        actual = hsv[k];
-        t = 0;
-        break;
-      case 2:
-        previous = actual;
-        actual = somethingElse[k];
-        t = 0;
-        break;
-      default:
-        break;
       }
-    }
-    if (m.addressPattern() == "/interpVal")
-    {
-      m >> iVal;
+      break;
+    case OscCommand::INTERP_VAL:
+      iVal = c.f;
+      break;
+    case OscCommand::Z_SCALE:
+      zScale = c.f;
+      break;
+    case OscCommand::ROTATION:
+      rotation = c.f;
+      break;
+    default:
+      break;
     }
   }
 
   void onDraw(Graphics &g) override
   {
+    PROFILE("onDraw");
     g.clear(0.0f);
-    g.shader(pointShader);
+    if (pointSprites)
+    {
+      glEnable(GL_PROGRAM_POINT_SIZE);
+      g.shader(spriteShader);
+      g.shader().uniform("viewportSize", float(fbWidth()), float(fbHeight()));
+      g.shader().uniform("maxPointSize", maxPointSize);
+    }
+    else
+      g.shader(pointShader);
     g.shader().uniform("pointSize", pointSize / 100);
     g.pointSize(1.5);
 
@@ -223,19 +491,147 @@ public:
 
     //g.meshColor();
     g.rotate(rotation, (Vec3f(0, 1, 0)));
-    g.draw(current[k]);
+    if (gpuMorph)
+    {
+      g.shader().uniform("t", t);
+      g.shader().uniform("iVal", iVal);
+      g.shader().uniform("zScale", zScale.get());
+      if (fromSlot && toSlot && tintSlot)
+      {
+        LayoutBuffers &from = fromSlot->gpu, &to = toSlot->gpu, &tint = tintSlot->gpu;
+        const ImageLevel &fromLevel = fromSlot->data.level(level), &toLevel = toSlot->data.level(level),
+                         &tintLevel = tintSlot->data.level(level);
+        int n = min(tintLevel.points(), min(fromLevel.points(), toLevel.points()));
+        MorphOffsets offsets;
+        offsets.previous = fromLevel.first;
+        offsets.actual = toLevel.first;
+        offsets.colors = tintLevel.first;
+        const CompactLayout &fromLayout = fromSlot->data.layouts[previous.layout];
+        const CompactLayout &toLayout = toSlot->data.layouts[actual.layout];
+        g.shader().uniform("previousOrigin", fromLayout.origin);
+        g.shader().uniform("previousExtent", fromLayout.extent);
+        g.shader().uniform("actualOrigin", toLayout.origin);
+        g.shader().uniform("actualExtent", toLayout.extent);
+        if (culling)
+        {
+          {
+            PROFILE("cull");
+            culler.budget = pointBudget.get();
+            culler.pointsPerPixel = pointsPerPixel;
+            culler.select(fromSlot->data, fromLevel, previous.layout, toLevel, actual.layout, (t * iVal) / 2.0,
+                          zScale, pointSize / 100 * 1.5, g.projMatrix() * g.viewMatrix() * g.modelMatrix(), width(),
+                          height(), n);
+          }
+          morphDraw.draw(g, from.positions[previous.layout], to.positions[actual.layout], tint.colors,
+                         culler.firsts.data(), culler.counts.data(), culler.firsts.size(), offsets);
+          times.points = culler.points;
+        }
+        else
+        {
+          morphDraw.draw(g, from.positions[previous.layout], to.positions[actual.layout], tint.colors, n, offsets);
+          times.points = n;
+        }
+      }
+    }
+    else
+    {
+      // current is already morphed and displaced: a = t * iVal / 2 = 1
+      g.shader().uniform("t", 2.0f);
+      g.shader().uniform("iVal", 1.0f);
+      g.shader().uniform("zScale", 0.0f);
+      g.shader().uniform("actualOrigin", Vec3f(0, 0, 0));
+      g.shader().uniform("actualExtent", Vec3f(1, 1, 1));
+      if (currentPoints && tintSlot)
+      {
+        morphDraw.draw(g, current.object(), currentBase, tintSlot->gpu.colors, currentColorOffset, currentPoints);
+        current.fence();
+        times.points = currentPoints;
+      }
+    }
+    uint64_t onScreen = OscCommandQueue::now();
+    for (auto &c : applied)
+      latency.add(c.type, c.arrival, onScreen);
+    applied.clear();
+    if (!firstFrameReported && tintSlot)
+    {
+      firstFrameReported = true;
+      cout << "first image on screen after " << library.elapsed() * 1000 << " ms" << endl;
+    }
     // point shader not working
     // also crashing
     // make image 500x500
   }
+
+  // audio thread: the inputs mixed to mono, in pieces small enough for the
+  // stack
+  void onSound(AudioIOData &io) override
+  {
+    if (analysisRate != io.framesPerSecond())
+    {
+      analysisRate = io.framesPerSecond();
+      analysis.setup(analysisRate);
+    }
+    int channels = io.channelsIn();
+    float block[64];
+    int n = 0;
+    while (io())
+    {
+      float sum = 0;
+      for (int c = 0; c < channels; c++)
+        sum += io.in(c);
+      block[n++] = channels ? sum / channels : 0;
+      if (n == 64)
+      {
+        analysis.process(block, n);
+        n = 0;
+      }
+    }
+    analysis.process(block, n);
+  }
+
+  void onExit() override
+  {
+    cout << "osc: " << oscCommands.received() << " commands, " << oscCommands.coalesced() << " coalesced, "
+         << oscCommands.dropped() << " dropped (queue full)" << endl;
+    latency.print(cout);
+    if (oscRecorder.recording())
+      cout << "recorded " << oscRecorder.count() << " commands to " << recordPath << endl;
+    oscReplayer.stop();
+    oscRecorder.close(); // after any late onMessage's write (it locks)
+    cout << "analysis: " << analysis.frames() << " frames, " << analysis.dropped() << " dropped" << endl;
+  }
 };
 
-int main()
+#ifndef FINALPROJECT_NO_MAIN
+int main(int argc, char *argv[])
 {
   MyApp app;
-  app.configureAudio(48000, 512, 2, 0);
+  // finalproject [--record trace | --replay trace [--speed x]] [--size pixels] [image directory]
+  //              [resident images]
+  vector<string> args;
+  for (int i = 1; i < argc; i++)
+  {
+    string a = argv[i];
+    if (a == "--record" && i + 1 < argc)
+      app.recordPath = argv[++i];
+    else if (a == "--replay" && i + 1 < argc)
+      app.replayPath = argv[++i];
+    else if (a == "--speed" && i + 1 < argc)
+      app.replaySpeed = atof(argv[++i]);
+    else if (a == "--size" && i + 1 < argc)
+      app.maxSide = atoi(argv[++i]);
+    else
+      args.push_back(a);
+  }
+  if (args.size() > 0)
+    app.imageDirectory = args[0];
+  if (args.size() > 1)
+    app.residentImages = atoi(args[1].c_str());
+  // the analysis listens to the inputs, one FFT frame per block
+  app.configureAudio(48000, 512, 2, 2);
   app.start();
 }
+#endif
 
 string slurp(string fileName)
 {
@@ -248,4 +644,11 @@ string slurp(string fileName)
     returnValue += line + "\n";
   }
   return returnValue;
-}
\ No newline at end of file
+}
+
+// the shader source with #define name added after its #version line
+string define(string source, string name)
+{
+  size_t line = source.find('\n') + 1;
+  return source.substr(0, line) + "#define " + name + "\n" + source.substr(line);
+}
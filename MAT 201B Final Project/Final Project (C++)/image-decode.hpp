@@ -0,0 +1,195 @@
+#pragma once
+
+// decodes an image of any size straight to the resolution the point clouds
+// are built at (no side longer than maxSide), and the box filter that makes
+// the smaller levels of an image's pyramid from it.
+//
+// built with -DFINALPROJECT_LIBJPEG (and -ljpeg), jpegs are scaled by the
+// decoder itself: libjpeg can drop the high frequencies of every 8x8 block and
+// decode at 1/2, 1/4 or 1/8 size, which for a 6000x4000 photo is most of the
+// work saved. whatever is left (and every other format, through al::Image) is
+// done with an area-average box filter.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "al/graphics/al_Image.hpp"
+
+#ifdef FINALPROJECT_LIBJPEG
+#include <csetjmp>
+
+#include <jpeglib.h>
+#endif
+
+// 8 bit rgba, rows top to bottom like al::Image
+struct Pixels
+{
+  int width = 0;
+  int height = 0;
+  std::vector<uint8_t> rgba;
+
+  const uint8_t *at(int x, int y) const { return &rgba[4 * (size_t(y) * width + x)]; }
+};
+
+// the average of every source pixel under each destination pixel
+inline void boxFilter(const Pixels &in, int width, int height, Pixels &out)
+{
+  out.width = width;
+  out.height = height;
+  out.rgba.assign(4 * size_t(width) * height, 0);
+  for (int y = 0; y < height; y++)
+  {
+    int y0 = int(int64_t(y) * in.height / height);
+    int y1 = std::max(y0 + 1, int(int64_t(y + 1) * in.height / height));
+    for (int x = 0; x < width; x++)
+    {
+      int x0 = int(int64_t(x) * in.width / width);
+      int x1 = std::max(x0 + 1, int(int64_t(x + 1) * in.width / width));
+      uint32_t sum[4] = {0, 0, 0, 0};
+      for (int sy = y0; sy < y1; sy++)
+        for (int sx = x0; sx < x1; sx++)
+        {
+          const uint8_t *p = in.at(sx, sy);
+          for (int c = 0; c < 4; c++)
+            sum[c] += p[c];
+        }
+      uint32_t n = uint32_t(y1 - y0) * (x1 - x0);
+      uint8_t *o = &out.rgba[4 * (size_t(y) * width + x)];
+      for (int c = 0; c < 4; c++)
+        o[c] = uint8_t((sum[c] + n / 2) / n);
+    }
+  }
+}
+
+// the size that fits in maxSide x maxSide with the same aspect (never larger
+// than the source; maxSide <= 0 keeps it)
+inline void fitSize(int width, int height, int maxSide, int &fitWidth, int &fitHeight)
+{
+  fitWidth = width;
+  fitHeight = height;
+  if (maxSide <= 0 || std::max(width, height) <= maxSide)
+    return;
+  if (width >= height)
+  {
+    fitWidth = maxSide;
+    fitHeight = std::max(1, int((int64_t(height) * maxSide + width / 2) / width));
+  }
+  else
+  {
+    fitHeight = maxSide;
+    fitWidth = std::max(1, int((int64_t(width) * maxSide + height / 2) / height));
+  }
+}
+
+#ifdef FINALPROJECT_LIBJPEG
+// libjpeg's error handler must not return; this one jumps back into
+// decodeJpeg, which cleans up and reports the image as failed
+struct JpegErrors
+{
+  jpeg_error_mgr base;
+  jmp_buf failed;
+};
+
+inline void jpegErrorExit(j_common_ptr jpeg)
+{
+  jpeg->err->output_message(jpeg);
+  longjmp(((JpegErrors *)jpeg->err)->failed, 1);
+}
+
+// false if it isn't a jpeg (or is a broken one)
+inline bool decodeJpeg(const std::string &file, int maxSide, Pixels &out)
+{
+  FILE *f = fopen(file.c_str(), "rb");
+  if (!f)
+    return false;
+  unsigned char magic[2] = {0, 0};
+  if (fread(magic, 1, 2, f) != 2 || magic[0] != 0xFF || magic[1] != 0xD8)
+  {
+    fclose(f);
+    return false;
+  }
+  rewind(f);
+
+  // nothing with a destructor may start after the setjmp
+  std::vector<uint8_t> row;
+  JpegErrors errors;
+  jpeg_decompress_struct jpeg;
+  jpeg.err = jpeg_std_error(&errors.base);
+  errors.base.error_exit = jpegErrorExit;
+  if (setjmp(errors.failed))
+  {
+    jpeg_destroy_decompress(&jpeg);
+    fclose(f);
+    return false;
+  }
+  jpeg_create_decompress(&jpeg);
+  jpeg_stdio_src(&jpeg, f);
+  jpeg_read_header(&jpeg, TRUE);
+
+  // the smallest 1/2^n scale that is still at least the target size
+  int fitWidth, fitHeight;
+  fitSize(jpeg.image_width, jpeg.image_height, maxSide, fitWidth, fitHeight);
+  int denom = 1;
+  while (denom < 8 && int(jpeg.image_width) / (denom * 2) >= fitWidth &&
+         int(jpeg.image_height) / (denom * 2) >= fitHeight)
+    denom *= 2;
+  jpeg.scale_num = 1;
+  jpeg.scale_denom = denom;
+  jpeg.out_color_space = JCS_RGB;
+  jpeg_start_decompress(&jpeg);
+
+  out.width = jpeg.output_width;
+  out.height = jpeg.output_height;
+  out.rgba.resize(4 * size_t(out.width) * out.height);
+  row.resize(3 * size_t(out.width));
+  while (jpeg.output_scanline < jpeg.output_height)
+  {
+    uint8_t *rows[1] = {row.data()};
+    uint8_t *o = &out.rgba[4 * size_t(jpeg.output_scanline) * out.width];
+    jpeg_read_scanlines(&jpeg, rows, 1);
+    for (int x = 0; x < out.width; x++)
+    {
+      o[4 * x + 0] = row[3 * x + 0];
+      o[4 * x + 1] = row[3 * x + 1];
+      o[4 * x + 2] = row[3 * x + 2];
+      o[4 * x + 3] = 255;
+    }
+  }
+  jpeg_finish_decompress(&jpeg);
+  jpeg_destroy_decompress(&jpeg);
+  fclose(f);
+  return true;
+}
+#endif
+
+// the image at no more than maxSide pixels on its longer side
+inline bool decodeImage(const std::string &file, int maxSide, Pixels &out)
+{
+  Pixels decoded;
+  bool ok = false;
+#ifdef FINALPROJECT_LIBJPEG
+  ok = decodeJpeg(file, maxSide, decoded);
+#endif
+  if (!ok)
+  {
+    al::Image image(file);
+    decoded.width = image.width();
+    decoded.height = image.height();
+    decoded.rgba = std::move(image.array());
+    ok = decoded.width > 0 && decoded.height > 0 &&
+         decoded.rgba.size() == 4 * size_t(decoded.width) * decoded.height;
+  }
+  if (!ok)
+    return false;
+
+  int width, height;
+  fitSize(decoded.width, decoded.height, maxSide, width, height);
+  if (width == decoded.width && height == decoded.height)
+    out = std::move(decoded);
+  else
+    boxFilter(decoded, width, height, out);
+  return true;
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+// a bounded set of resident images over an arbitrarily long list of files.
+// each slot holds one image (compact layouts in RAM plus its GPU buffers);
+// when a new image arrives and the slots are full, the least recently used
+// one is evicted. images are decoded by the loader's worker threads, so the
+// graphics thread never blocks: use() of an image that isn't resident queues
+// it and returns nullptr until it is there. prefetch() queues an image in the
+// background before it is asked for. a decoded image that finds every slot
+// on screen waits, decoded, until one comes free instead of being decoded
+// again. at most a slot's worth wait here and as many more in the loader,
+// which stops decoding until they are taken, so nothing decoded is dropped.
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+#include "image-loader.hpp"
+#include "layout-buffers.hpp"
+
+class ImageLibrary
+{
+public:
+  struct Slot
+  {
+    int image = -1;
+    CompactImage data;
+    LayoutBuffers gpu;
+    uint64_t used = 0; // frame of the last use()
+  };
+
+  // what one image cost to bring in, in seconds
+  struct Load
+  {
+    int image;
+    bool cached;
+    double decode, build, upload;
+  };
+
+  // every jpeg and png in a directory, sorted by name
+  static std::vector<std::string> scan(const std::string &dir)
+  {
+    std::vector<std::string> files;
+#ifndef _WIN32
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+      return files;
+    while (dirent *entry = readdir(d))
+    {
+      std::string name = entry->d_name;
+      size_t dot = name.find_last_of('.');
+      if (name[0] == '.' || dot == std::string::npos)
+        continue;
+      std::string ext = name.substr(dot + 1);
+      std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+      if (ext == "jpg" || ext == "jpeg" || ext == "png")
+        files.push_back(dir + "/" + name);
+    }
+    closedir(d);
+    std::sort(files.begin(), files.end());
+#endif
+    return files;
+  }
+
+  // capacity is the most images resident at once (at least 3: the two being
+  // morphed between and the one whose colors are shown). images are decoded
+  // to no more than maxSide pixels on their longer side, 0 for any size
+  void open(const std::vector<std::string> &files, int capacity, const std::string &cacheDir = "", int maxSide = 0)
+  {
+    mFiles = files;
+    mCapacity = std::max(3, capacity);
+    mSlots.reset(new Slot[mCapacity]);
+    mSlotOf.assign(files.size(), -1);
+    mFailed.assign(files.size(), false);
+    mPending.clear();
+    mFrame = 1;
+    loader.cacheDirectory(cacheDir);
+    loader.maxSide(maxSide);
+    loader.maxReady(mCapacity);
+    loader.start(files);
+  }
+
+  int size() const { return mFiles.size(); }
+  int capacity() const { return mCapacity; }
+  const std::string &file(int image) const { return mFiles[image]; }
+  bool resident(int image) const { return valid(image) && mSlotOf[image] >= 0; }
+  bool failed(int image) const { return valid(image) && mFailed[image]; }
+  double elapsed() const { return loader.elapsed(); }
+  bool idle() { return loader.idle(); }
+
+  int residentCount() const
+  {
+    int n = 0;
+    for (int s = 0; s < mCapacity; s++)
+      n += mSlots[s].image >= 0;
+    return n;
+  }
+
+  size_t residentBytes() const
+  {
+    size_t b = 0;
+    for (int s = 0; s < mCapacity; s++)
+      if (mSlots[s].image >= 0)
+        b += mSlots[s].data.bytes();
+    return b;
+  }
+
+  // graphics thread, once a frame before any use(): takes in finished loads,
+  // as many as can wait for a slot; the rest stay with the loader
+  void update()
+  {
+    mFrame++;
+    ImageLayouts done;
+    while ((int)mPending.size() < mCapacity && loader.poll(done))
+    {
+      int p = done.index;
+      if (!done.ok)
+      {
+        std::cout << "failed to load image " << p << " " << mFiles[p] << std::endl;
+        mFailed[p] = true;
+        continue;
+      }
+      if (mSlotOf[p] >= 0 || pending(p))
+        continue;
+      mPending.push_back(std::move(done));
+    }
+
+    // oldest first, while there are slots to give
+    size_t taken = 0;
+    for (; taken < mPending.size(); taken++)
+    {
+      int s = victim();
+      if (s < 0)
+        break; // every slot was on screen last frame; the rest wait
+      take(mPending[taken], s);
+    }
+    mPending.erase(mPending.begin(), mPending.begin() + taken);
+  }
+
+  // the slot holding an image, marked as used this frame. nullptr while it
+  // is loading; the first call queues it ahead of any prefetch
+  Slot *use(int image)
+  {
+    if (!valid(image) || mFailed[image])
+      return nullptr;
+    int s = mSlotOf[image];
+    if (s < 0)
+    {
+      if (!pending(image))
+        loader.request(image, true);
+      return nullptr;
+    }
+    mSlots[s].used = mFrame;
+    return &mSlots[s];
+  }
+
+  // queue an image behind everything urgent if it isn't resident or coming
+  void prefetch(int image)
+  {
+    if (valid(image) && !mFailed[image] && mSlotOf[image] < 0 && !pending(image))
+      loader.request(image, false);
+  }
+
+  // drop prefetches that haven't started
+  void cancelPrefetches() { loader.cancelQueued(); }
+
+  // every image taken in so far, in order (an evicted image that comes back
+  // is there twice)
+  const std::vector<Load> &loads() const { return mLoads; }
+
+private:
+  bool valid(int image) const { return image >= 0 && image < (int)mFiles.size(); }
+
+  // decoded, waiting for a slot
+  bool pending(int image) const
+  {
+    for (auto &l : mPending)
+      if (l.index == image)
+        return true;
+    return false;
+  }
+
+  // a decoded image into slot s, evicting whatever was there
+  void take(ImageLayouts &done, int s)
+  {
+    int p = done.index;
+    Slot &slot = mSlots[s];
+    if (slot.image >= 0)
+      mSlotOf[slot.image] = -1;
+    slot.image = p;
+    slot.data = std::move(done.image);
+    auto t0 = std::chrono::steady_clock::now();
+    {
+      PROFILE("upload");
+      slot.gpu.upload(slot.data);
+    }
+    double upload = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    mLoads.push_back({p, done.cached, done.decodeSeconds, done.buildSeconds, upload});
+    slot.used = mFrame - 1;
+    mSlotOf[p] = s;
+
+    std::cout << "loaded image " << p << " " << mFiles[p] << " size: " << slot.data.width << ", " << slot.data.height;
+    if (done.cached)
+      std::cout << " (mapped from cache in " << done.buildSeconds * 1000 << " ms)" << std::endl;
+    else
+      std::cout << " (decode " << done.decodeSeconds * 1000 << " ms, layouts " << done.buildSeconds * 1000 << " ms)" << std::endl;
+    // memory report: what this image costs now vs. as float meshes
+    std::cout << "  memory: " << CompactImage::floatMeshBytes(slot.data.level(0).points()) / 1024 << " KB as float meshes, "
+              << slot.data.bytes() / 1024 << " KB compact, " << slot.gpu.bytes() / 1024 << " KB on the GPU (" << slot.data.levels.size()
+              << " levels)" << std::endl;
+  }
+
+  // an empty slot, else the least recently used one that wasn't needed last
+  // frame, else -1
+  int victim() const
+  {
+    int best = -1;
+    for (int s = 0; s < mCapacity; s++)
+    {
+      if (mSlots[s].image < 0)
+        return s;
+      if (mSlots[s].used >= mFrame - 1)
+        continue;
+      if (best < 0 || mSlots[s].used < mSlots[best].used)
+        best = s;
+    }
+    return best;
+  }
+
+  ImageLoader loader;
+  std::vector<std::string> mFiles;
+  int mCapacity = 0;
+  std::unique_ptr<Slot[]> mSlots;
+  std::vector<int> mSlotOf; // image -> slot, -1 if not resident
+  std::vector<bool> mFailed;
+  std::vector<Load> mLoads;
+  std::vector<ImageLayouts> mPending; // decoded, no slot yet, oldest first
+  uint64_t mFrame = 1;
+};
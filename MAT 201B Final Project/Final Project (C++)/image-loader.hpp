@@ -0,0 +1,309 @@
+#pragma once
+
+// decodes images and builds the four point-cloud layouts for each one on
+// worker threads. images are loaded on request(), most urgent first, and
+// handed to the graphics thread through poll() in the order they complete, so
+// the first one can go on screen while the rest are still being built.
+//
+// images of any size are decoded at (at most) the size the points are built
+// at, see image-decode.hpp. with a cache directory set, an image whose point
+// cache is current is mapped instead of decoded, and freshly built layouts are
+// written back for next time.
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "al/app/al_App.hpp"
+
+#include "../../common/frame-profiler.hpp"
+
+#include "image-decode.hpp"
+#include "point-cache.hpp"
+
+struct ImageLayouts
+{
+  int index = -1; // position in the file list
+  bool ok = false;
+  bool cached = false; // came from the point cache instead of the jpeg
+  CompactImage image;
+  double decodeSeconds = 0;
+  double buildSeconds = 0;
+};
+
+// one pass over the pixels of every level of the pyramid computes all four
+// layouts, which are then put in chunk order (level by level) and quantized
+// into the compact image
+inline void buildLayouts(const Pixels &image, CompactImage &out)
+{
+  using namespace al;
+  out.width = image.width;
+  out.height = image.height;
+  size_t total = CompactImage::pyramidPoints(image.width, image.height);
+
+  std::vector<Vec3f> positions[LAYOUTS];
+  std::vector<Color> colors;
+  for (auto &p : positions)
+    p.reserve(total);
+  colors.reserve(total);
+
+  Pixels level = image, smaller;
+  std::vector<uint32_t> order;
+  for (int l = CompactImage::levelCount(image.width, image.height); l > 0; l--)
+  {
+    int W = level.width;
+    int H = level.height;
+    CompactImage::chunkOrder(W, H, order);
+    for (uint32_t pixel : order)
+    {
+      // iterate through all the pixel, scanning each row
+      int row = pixel / W, column = pixel % W;
+      const uint8_t *p = level.at(column, H - row - 1);
+      float r = p[0] / 255.0;
+      float g = p[1] / 255.0;
+      float b = p[2] / 255.0;
+      colors.push_back(Color(r, g, b));
+
+      positions[PIC_LAYOUT].push_back(Vec3f(1.0 * column / W, 1.0 * row / H, 0.0));
+
+      positions[RGB_LAYOUT].push_back(Vec3f(-1.0 * r + 1.0, g, b));
+
+      //hueSatVal.s = p, hueSatVal.h = azimuth, hueSatVal.v = height; multiply azimuth by twopi
+      HSV hueSatVal(Color(r, g, b));
+      positions[HSV_LAYOUT].push_back(Vec3f(((hueSatVal.s * cos(hueSatVal.h * M_2PI)) / 2.0) + 0.5, (hueSatVal.v * 1.1), ((hueSatVal.s * sin(hueSatVal.h * M_2PI))) / 2.0));
+
+      positions[SOMETHING_ELSE_LAYOUT].push_back(Vec3f(1.0 * column / W, 1.0 * row / H, b * 2.0));
+    }
+    boxFilter(level, (W + 1) / 2, (H + 1) / 2, smaller);
+    std::swap(level, smaller);
+  }
+
+  for (int l = 0; l < LAYOUTS; l++)
+    out.layouts[l].quantize(positions[l]);
+  out.pack(colors);
+  out.findLevels();
+}
+
+class ImageLoader
+{
+public:
+  ~ImageLoader() { stop(); }
+
+  // empty (the default) turns the point cache off
+  void cacheDirectory(const std::string &dir) { mCacheDir = dir; }
+
+  // images are decoded to at most this many pixels on their longer side
+  // (0 keeps their own size). set before start()
+  void maxSide(int side) { mMaxSide = side; }
+
+  // at most this many images loading or loaded and not yet poll()ed; past it
+  // the workers wait for the graphics thread to take some (0 for no limit)
+  void maxReady(int images) { mMaxReady = images; }
+
+  // starts the workers; nothing is loaded until it is request()ed.
+  // threads = 0 uses every core (but never more threads than images)
+  void start(const std::vector<std::string> &files, int threads = 0)
+  {
+    stop();
+    mFiles = files;
+    mState.assign(mFiles.size(), IDLE);
+    mStopping = false;
+    mStart = std::chrono::steady_clock::now();
+    if (!mCacheDir.empty())
+      pointcache::makeDirectory(mCacheDir);
+    if (threads <= 0)
+      threads = std::thread::hardware_concurrency();
+    if (threads <= 0)
+      threads = 1;
+    if (threads > (int)mFiles.size())
+      threads = mFiles.size();
+    for (int i = 0; i < threads; i++)
+      mWorkers.emplace_back([this]() { work(); });
+  }
+
+  // queue an image. urgent requests go ahead of prefetches; an image that is
+  // already queued or loading is not queued twice
+  void request(int index, bool urgent = false)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mLock);
+      if (index < 0 || index >= (int)mFiles.size())
+        return;
+      if (mState[index] == QUEUED && urgent)
+      {
+        // promote a prefetch that is now needed on screen
+        for (auto it = mQueue.begin(); it != mQueue.end(); ++it)
+          if (*it == index)
+          {
+            mQueue.erase(it);
+            break;
+          }
+        mQueue.push_front(index);
+      }
+      if (mState[index] != IDLE)
+        return;
+      mState[index] = QUEUED;
+      if (urgent)
+        mQueue.push_front(index);
+      else
+        mQueue.push_back(index);
+    }
+    mWake.notify_one();
+  }
+
+  // forget queued requests that have not started, e.g. when the prediction
+  // of what comes next has changed
+  void cancelQueued()
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (int index : mQueue)
+      mState[index] = IDLE;
+    mQueue.clear();
+  }
+
+  // graphics thread: take one finished image, if any
+  bool poll(ImageLayouts &out)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mLock);
+      if (mReady.empty())
+        return false;
+      out = std::move(mReady.front());
+      mReady.pop_front();
+      mState[out.index] = IDLE;
+    }
+    mWake.notify_one(); // room for a worker waiting on maxReady
+    return true;
+  }
+
+  // queued, loading or waiting to be polled
+  bool pending(int index)
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mState[index] != IDLE;
+  }
+
+  bool idle()
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mQueue.empty() && mReady.empty() && mLoading == 0;
+  }
+
+  int total() const { return mFiles.size(); }
+
+  // seconds since start()
+  double elapsed() const
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count();
+  }
+
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mLock);
+      mStopping = true;
+      mQueue.clear();
+    }
+    mWake.notify_all();
+    for (auto &w : mWorkers)
+      w.join();
+    mWorkers.clear();
+  }
+
+private:
+  enum State : char
+  {
+    IDLE,
+    QUEUED,
+    LOADING,
+    READY
+  };
+
+  void work()
+  {
+    while (true)
+    {
+      int p;
+      {
+        std::unique_lock<std::mutex> lock(mLock);
+        mWake.wait(lock, [this]() { return mStopping || (!mQueue.empty() && room()); });
+        if (mStopping)
+          return;
+        p = mQueue.front();
+        mQueue.pop_front();
+        mState[p] = LOADING;
+        mLoading++;
+      }
+
+      ImageLayouts result;
+      load(p, result);
+
+      std::lock_guard<std::mutex> lock(mLock);
+      mReady.push_back(std::move(result));
+      mState[p] = READY;
+      mLoading--;
+    }
+  }
+
+  // under mLock: maxReady allows another load to start
+  bool room() const { return mMaxReady <= 0 || (int)mReady.size() + mLoading < mMaxReady; }
+
+  void load(int p, ImageLayouts &result)
+  {
+    PROFILE("load");
+    using clock = std::chrono::steady_clock;
+    result.index = p;
+    auto t0 = clock::now();
+    auto t1 = t0;
+    uint64_t sourceSize = 0;
+    int64_t sourceMtime = 0;
+    bool stamped = !mCacheDir.empty() && pointcache::sourceStamp(mFiles[p], sourceSize, sourceMtime);
+    std::string cacheFile = stamped ? pointcache::cachePath(mCacheDir, mFiles[p]) : "";
+
+    auto cache = std::make_shared<pointcache::Mapped>();
+    if (stamped && cache->open(cacheFile, sourceSize, sourceMtime, mMaxSide))
+    {
+      pointcache::share(cache, result.image); // points into the file
+      result.image.findLevels();
+      result.ok = result.cached = true;
+    }
+    else
+    {
+      Pixels image;
+      {
+        PROFILE("decode");
+        result.ok = decodeImage(mFiles[p], mMaxSide, image);
+      }
+      t1 = clock::now();
+      if (result.ok)
+      {
+        PROFILE("build");
+        buildLayouts(image, result.image);
+        if (stamped)
+          pointcache::write(cacheFile, result.image, sourceSize, sourceMtime, mMaxSide);
+      }
+    }
+    auto t2 = clock::now();
+    result.decodeSeconds = std::chrono::duration<double>(t1 - t0).count();
+    result.buildSeconds = std::chrono::duration<double>(t2 - t1).count();
+  }
+
+  std::vector<std::string> mFiles;
+  std::string mCacheDir;
+  int mMaxSide = 0;
+  int mMaxReady = 0;
+  std::vector<std::thread> mWorkers;
+  std::mutex mLock;
+  std::condition_variable mWake;
+  std::deque<int> mQueue;
+  std::vector<State> mState;
+  int mLoading = 0;
+  bool mStopping = false;
+  std::deque<ImageLayouts> mReady;
+  std::chrono::steady_clock::time_point mStart;
+};
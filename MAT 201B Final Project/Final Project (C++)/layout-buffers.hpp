@@ -0,0 +1,132 @@
+#pragma once
+
+// keeps every layout of an image in its own vertex buffer on the GPU. the
+// buffers are uploaded once when the image arrives; after that a frame only
+// binds two position buffers (the layout being morphed away from and the one
+// being morphed to) plus the colors, and point-vertex.glsl does the blending
+// and the luminance z displacement. the cost per frame no longer depends on
+// the number of points.
+//
+// the buffers hold the compact format: 16 bit normalized positions, which the
+// shader scales by each layout's origin/extent, and 8 bit normalized colors.
+// every level of the image's pyramid is in them; a draw picks one by offset.
+
+#include <algorithm>
+
+#include "al/graphics/al_BufferObject.hpp"
+#include "al/graphics/al_Graphics.hpp"
+#include "al/graphics/al_OpenGL.hpp"
+#include "al/graphics/al_VAO.hpp"
+
+#include "compact-layouts.hpp"
+
+// attribute locations, see point-vertex.glsl
+enum MorphAttribute
+{
+  ACTUAL_POSITION = 0,
+  POINT_COLOR = 1,
+  PREVIOUS_POSITION = 2
+};
+
+struct LayoutBuffers
+{
+  al::BufferObject positions[LAYOUTS];
+  al::BufferObject colors;
+  int points = 0;
+  bool uploaded = false;
+
+  void upload(const CompactImage &image)
+  {
+    points = image.points();
+    for (int l = 0; l < LAYOUTS; l++)
+      store(positions[l], image.layouts[l].data(), image.layouts[l].bytes());
+    store(colors, image.colors(), image.colorBytes());
+    uploaded = true;
+  }
+
+  size_t bytes() const { return points * (LAYOUTS * 3 * sizeof(uint16_t) + 4); }
+
+private:
+  static void store(al::BufferObject &buffer, const void *data, size_t bytes)
+  {
+    buffer.bufferType(GL_ARRAY_BUFFER);
+    buffer.usage(GL_STATIC_DRAW);
+    if (!buffer.created())
+      buffer.create();
+    buffer.bind();
+    buffer.data(bytes, data);
+    buffer.unbind();
+  }
+};
+
+// where each buffer's points start, in points: the level of the pyramid
+// being drawn can be at a different place in each image
+struct MorphOffsets
+{
+  GLint previous = 0, actual = 0, colors = 0;
+};
+
+// draws points whose position is blended between two resident layouts
+class MorphDraw
+{
+public:
+  // the caller has already bound the shader and set its uniforms, including
+  // the origin/extent of both layouts
+  void draw(al::Graphics &g, al::BufferObject &previous, al::BufferObject &actual,
+            al::BufferObject &colors, int points, const MorphOffsets &offsets = MorphOffsets())
+  {
+    bind(g, previous, actual, colors, offsets);
+    glDrawArrays(GL_POINTS, 0, points);
+    mVAO.unbind();
+  }
+
+  // only the given ranges of points, e.g. the chunks that are on screen
+  void draw(al::Graphics &g, al::BufferObject &previous, al::BufferObject &actual,
+            al::BufferObject &colors, const GLint *firsts, const GLsizei *counts, int ranges,
+            const MorphOffsets &offsets = MorphOffsets())
+  {
+    bind(g, previous, actual, colors, offsets);
+    glMultiDrawArrays(GL_POINTS, firsts, counts, ranges);
+    mVAO.unbind();
+  }
+
+  // points the CPU already morphed: float positions from byte base of
+  // positions, used as both ends (the caller sets t and iVal so a = 1)
+  void draw(al::Graphics &g, al::BufferObject &positions, size_t base, al::BufferObject &colors, GLint colorOffset,
+            int points)
+  {
+    bind(g, positions, base, positions, base, GL_FLOAT, colors, colorOffset * 4);
+    glDrawArrays(GL_POINTS, 0, points);
+    mVAO.unbind();
+  }
+
+private:
+  // compact positions: 3 normalized shorts a point
+  void bind(al::Graphics &g, al::BufferObject &previous, al::BufferObject &actual, al::BufferObject &colors,
+            const MorphOffsets &offsets)
+  {
+    const size_t bytes = 3 * sizeof(uint16_t);
+    bind(g, previous, offsets.previous * bytes, actual, offsets.actual * bytes, GL_UNSIGNED_SHORT, colors,
+         offsets.colors * 4);
+  }
+
+  // offsets in bytes
+  void bind(al::Graphics &g, al::BufferObject &previous, size_t previousOffset, al::BufferObject &actual,
+            size_t actualOffset, GLenum positionType, al::BufferObject &colors, size_t colorOffset)
+  {
+    GLboolean normalized = positionType == GL_FLOAT ? GL_FALSE : GL_TRUE;
+    if (!mVAO.created())
+      mVAO.create();
+
+    g.update(); // push the current matrices to the shader
+    mVAO.bind();
+    mVAO.enableAttrib(ACTUAL_POSITION);
+    mVAO.attribPointer(ACTUAL_POSITION, actual, 3, positionType, normalized, 0, (const void *)actualOffset);
+    mVAO.enableAttrib(POINT_COLOR);
+    mVAO.attribPointer(POINT_COLOR, colors, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, (const void *)colorOffset);
+    mVAO.enableAttrib(PREVIOUS_POSITION);
+    mVAO.attribPointer(PREVIOUS_POSITION, previous, 3, positionType, normalized, 0, (const void *)previousOffset);
+  }
+
+  al::VAO mVAO;
+};
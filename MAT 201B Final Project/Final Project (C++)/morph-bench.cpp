@@ -0,0 +1,101 @@
+// micro-benchmark for the CPU morph: the loop onAnimate used to run (float3
+// lerp plus a luminance() per point) against the kernels in morph-kernel.hpp,
+// at 250k points (one 500x500 image) and 4M points (2000x2000).
+//
+// doesn't need allolib:
+//   c++ -O3 -std=c++14 -pthread morph-bench.cpp -o morph-bench && ./morph-bench
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "morph-kernel.hpp"
+
+// stand-ins for al::Vec3f and al::Color, with the same math
+struct Vec3
+{
+  float x, y, z;
+  Vec3 operator*(float s) const { return {x * s, y * s, z * s}; }
+  Vec3 operator+(const Vec3 &o) const { return {x + o.x, y + o.y, z + o.z}; }
+};
+struct RGBA
+{
+  float r, g, b, a;
+  float luminance() const { return r * 0.3f + g * 0.59f + b * 0.11f; }
+};
+
+template <class F>
+double bestOf(int runs, F f)
+{
+  double best = 1e9;
+  for (int r = 0; r < runs; r++)
+  {
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    if (ms < best)
+      best = ms;
+  }
+  return best;
+}
+
+int main()
+{
+  ThreadPool pool;
+  float t = 0.4f, iVal = 1.0f, zScale = 1.0f;
+  float a = (t * iVal) / 2.0;
+
+  printf("threads: %d, avx: %s\n", pool.size(),
+#ifdef MORPH_KERNEL_X86
+         morphkernel::hasAVX() ? "yes" : "no"
+#else
+         "n/a"
+#endif
+  );
+  printf("%10s %-24s %10s %12s\n", "points", "kernel", "ms/frame", "Mpoints/s");
+
+  for (size_t n : {size_t(250000), size_t(4000000)})
+  {
+    std::vector<Vec3> previous(n), actual(n), current(n);
+    std::vector<RGBA> colors(n);
+    MorphSoA from, to;
+    from.resize(n);
+    to.resize(n);
+    std::vector<float> luminance(n), out(3 * n);
+    srand(1);
+    for (size_t i = 0; i < n; i++)
+    {
+      previous[i] = {rand() / float(RAND_MAX), rand() / float(RAND_MAX), 0};
+      actual[i] = {rand() / float(RAND_MAX), rand() / float(RAND_MAX), rand() / float(RAND_MAX)};
+      colors[i] = {rand() / float(RAND_MAX), rand() / float(RAND_MAX), rand() / float(RAND_MAX), 1};
+      from.x[i] = previous[i].x, from.y[i] = previous[i].y, from.z[i] = previous[i].z;
+      to.x[i] = actual[i].x, to.y[i] = actual[i].y, to.z[i] = actual[i].z;
+      luminance[i] = colors[i].luminance();
+    }
+
+    int runs = n > 1000000 ? 10 : 40;
+    auto report = [&](const char *name, double ms) {
+      printf("%10zu %-24s %10.3f %12.1f\n", n, name, ms, n / ms / 1000.0);
+    };
+
+    report("old loop (AoS)", bestOf(runs, [&]() {
+             for (size_t i = 0; i < n; i++)
+             {
+               current[i] = (previous[i] * (1 - (t * iVal) / 2.0)) + (actual[i] * ((t * iVal) / 2.0));
+               current[i].z += (colors[i].luminance() * zScale);
+             }
+           }));
+    report("scalar SoA", bestOf(runs, [&]() { morphkernel::scalar(from, to, luminance.data(), a, zScale, out.data(), 0, n); }));
+#ifdef MORPH_KERNEL_X86
+    report("SSE", bestOf(runs, [&]() { morphkernel::sse(from, to, luminance.data(), a, zScale, out.data(), 0, n); }));
+    if (morphkernel::hasAVX())
+      report("AVX", bestOf(runs, [&]() { morphkernel::avx(from, to, luminance.data(), a, zScale, out.data(), 0, n); }));
+#endif
+    report("best kernel, all threads", bestOf(runs, [&]() { morph(pool, from, to, luminance.data(), a, zScale, out.data(), n); }));
+
+    // keep the compiler honest
+    volatile float sink = out[n] + current[n / 2].z;
+    (void)sink;
+  }
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+// the CPU morph, for when the shader path can't be used (e.g. software GL).
+// the endpoints are kept as structure-of-arrays floats and the luminance of
+// every point is computed once per image instead of every frame, so a frame
+// is a straight stream over seven float arrays:
+//
+//   out = from * (1 - a) + to * a;  out.z += luminance * zScale
+//
+// the result is written interleaved (xyz xyz ...), ready to be a Mesh's
+// vertices. the kernel uses AVX when the CPU has it (checked at runtime),
+// SSE otherwise on x86, and plain C++ elsewhere; morph() splits the points
+// across a thread pool.
+
+#include <cstddef>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MORPH_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+#include "../../common/thread-pool.hpp"
+
+struct MorphSoA
+{
+  std::vector<float> x, y, z;
+
+  size_t size() const { return x.size(); }
+  void resize(size_t n)
+  {
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+  }
+};
+
+namespace morphkernel
+{
+
+  // the loop as it was: one point at a time
+  inline void scalar(const MorphSoA &from, const MorphSoA &to, const float *luminance, float a, float zScale,
+                     float *out, size_t begin, size_t end)
+  {
+    float b = 1 - a;
+    for (size_t i = begin; i < end; i++)
+    {
+      out[3 * i + 0] = from.x[i] * b + to.x[i] * a;
+      out[3 * i + 1] = from.y[i] * b + to.y[i] * a;
+      out[3 * i + 2] = from.z[i] * b + to.z[i] * a + luminance[i] * zScale;
+    }
+  }
+
+#ifdef MORPH_KERNEL_X86
+
+  // 4 points of x, y and z -> x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3. the
+  // AVX version does the same in each 128 bit half
+  inline void interleave(__m128 X, __m128 Y, __m128 Z, __m128 &o0, __m128 &o1, __m128 &o2)
+  {
+    __m128 xy01 = _mm_unpacklo_ps(X, Y);
+    __m128 xy23 = _mm_unpackhi_ps(X, Y);
+    o0 = _mm_shuffle_ps(xy01, _mm_shuffle_ps(Z, X, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 1, 0));
+    o1 = _mm_shuffle_ps(_mm_shuffle_ps(xy01, Z, _MM_SHUFFLE(1, 1, 3, 3)), xy23, _MM_SHUFFLE(1, 0, 2, 0));
+    o2 = _mm_shuffle_ps(_mm_shuffle_ps(Z, xy23, _MM_SHUFFLE(2, 2, 2, 2)),
+                        _mm_shuffle_ps(xy23, Z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+  }
+
+  inline void sse(const MorphSoA &from, const MorphSoA &to, const float *luminance, float a, float zScale,
+                  float *out, size_t begin, size_t end)
+  {
+    __m128 A = _mm_set1_ps(a), B = _mm_set1_ps(1 - a), S = _mm_set1_ps(zScale);
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+      __m128 X = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&from.x[i]), B), _mm_mul_ps(_mm_loadu_ps(&to.x[i]), A));
+      __m128 Y = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&from.y[i]), B), _mm_mul_ps(_mm_loadu_ps(&to.y[i]), A));
+      __m128 Z = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&from.z[i]), B), _mm_mul_ps(_mm_loadu_ps(&to.z[i]), A));
+      Z = _mm_add_ps(Z, _mm_mul_ps(_mm_loadu_ps(&luminance[i]), S));
+      __m128 o0, o1, o2;
+      interleave(X, Y, Z, o0, o1, o2);
+      _mm_storeu_ps(out + 3 * i + 0, o0);
+      _mm_storeu_ps(out + 3 * i + 4, o1);
+      _mm_storeu_ps(out + 3 * i + 8, o2);
+    }
+    scalar(from, to, luminance, a, zScale, out, i, end);
+  }
+
+  __attribute__((target("avx"))) inline void avx(const MorphSoA &from, const MorphSoA &to, const float *luminance,
+                                                 float a, float zScale, float *out, size_t begin, size_t end)
+  {
+    __m256 A = _mm256_set1_ps(a), B = _mm256_set1_ps(1 - a), S = _mm256_set1_ps(zScale);
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+      __m256 X = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&from.x[i]), B), _mm256_mul_ps(_mm256_loadu_ps(&to.x[i]), A));
+      __m256 Y = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&from.y[i]), B), _mm256_mul_ps(_mm256_loadu_ps(&to.y[i]), A));
+      __m256 Z = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&from.z[i]), B), _mm256_mul_ps(_mm256_loadu_ps(&to.z[i]), A));
+      Z = _mm256_add_ps(Z, _mm256_mul_ps(_mm256_loadu_ps(&luminance[i]), S));
+
+      __m256 xy01 = _mm256_unpacklo_ps(X, Y);
+      __m256 xy23 = _mm256_unpackhi_ps(X, Y);
+      __m256 o0 = _mm256_shuffle_ps(xy01, _mm256_shuffle_ps(Z, X, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 1, 0));
+      __m256 o1 = _mm256_shuffle_ps(_mm256_shuffle_ps(xy01, Z, _MM_SHUFFLE(1, 1, 3, 3)), xy23, _MM_SHUFFLE(1, 0, 2, 0));
+      __m256 o2 = _mm256_shuffle_ps(_mm256_shuffle_ps(Z, xy23, _MM_SHUFFLE(2, 2, 2, 2)),
+                                    _mm256_shuffle_ps(xy23, Z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+      // o0..o2 hold points 0-3 in their low halves and 4-7 in their high ones
+      _mm256_storeu_ps(out + 3 * i + 0, _mm256_permute2f128_ps(o0, o1, 0x20));
+      _mm256_storeu_ps(out + 3 * i + 8, _mm256_permute2f128_ps(o2, o0, 0x30));
+      _mm256_storeu_ps(out + 3 * i + 16, _mm256_permute2f128_ps(o1, o2, 0x31));
+    }
+    sse(from, to, luminance, a, zScale, out, i, end);
+  }
+
+  inline bool hasAVX()
+  {
+    static bool avx = __builtin_cpu_supports("avx");
+    return avx;
+  }
+
+#endif
+
+  // the widest kernel this CPU runs
+  inline void best(const MorphSoA &from, const MorphSoA &to, const float *luminance, float a, float zScale,
+                   float *out, size_t begin, size_t end)
+  {
+#ifdef MORPH_KERNEL_X86
+    if (hasAVX())
+      avx(from, to, luminance, a, zScale, out, begin, end);
+    else
+      sse(from, to, luminance, a, zScale, out, begin, end);
+#else
+    scalar(from, to, luminance, a, zScale, out, begin, end);
+#endif
+  }
+
+} // namespace morphkernel
+
+// morphs n points into out (3 * n floats) on every thread of the pool
+inline void morph(ThreadPool &pool, const MorphSoA &from, const MorphSoA &to, const float *luminance, float a,
+                  float zScale, float *out, size_t n)
+{
+  pool.parallelFor(
+      n, [&](size_t begin, size_t end) { morphkernel::best(from, to, luminance, a, zScale, out, begin, end); }, 8);
+}
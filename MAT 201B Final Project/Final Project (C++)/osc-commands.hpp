@@ -0,0 +1,136 @@
+#pragma once
+
+// the OSC messages from the Max patch that change what is on screen. the OSC
+// thread only parses them and pushes them into a lock-free queue; the
+// graphics thread drains the queue once a frame and applies them in order,
+// so k, t, iVal and the morph handles are only ever touched by one thread.
+//
+// a burst of onsets can send several /picType or /interpVal in one frame.
+// only the last /interpVal matters, and a /picType only matters if a
+// /meshType (which morphs to image k) comes after it, so the others are
+// dropped as coalesced before they are applied.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "al/protocol/al_OSC.hpp"
+
+#include "../../common/spsc-queue.hpp"
+
+struct OscCommand
+{
+  enum Type : uint8_t
+  {
+    PIC_TYPE,
+    MESH_TYPE,
+    INTERP_VAL,
+    Z_SCALE,
+    ROTATION,
+    COALESCED // superseded, only used inside drain()
+  };
+  Type type;
+  int i = 0;
+  float f = 0;
+  uint64_t arrival = 0; // steady clock nanoseconds, set by push()
+};
+
+class OscCommandQueue
+{
+public:
+  // false for messages that aren't commands (e.g. parameter server ones)
+  static bool parse(al::osc::Message &m, OscCommand &c)
+  {
+    if (m.addressPattern() == "/picType")
+    {
+      c.type = OscCommand::PIC_TYPE;
+      m >> c.i;
+    }
+    else if (m.addressPattern() == "/meshType")
+    {
+      c.type = OscCommand::MESH_TYPE;
+      m >> c.i;
+    }
+    else if (m.addressPattern() == "/interpVal")
+    {
+      c.type = OscCommand::INTERP_VAL;
+      m >> c.f;
+    }
+    // these are parameters, which the parameter server sets too; they come
+    // through here as well so they can be traced
+    else if (m.addressPattern() == "/zScale")
+    {
+      c.type = OscCommand::Z_SCALE;
+      m >> c.f;
+    }
+    else if (m.addressPattern() == "/rotation")
+    {
+      c.type = OscCommand::ROTATION;
+      m >> c.f;
+    }
+    else
+      return false;
+    return true;
+  }
+
+  static uint64_t now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // OSC thread (or the trace replayer, but never both). false if the queue
+  // was full
+  bool push(OscCommand c)
+  {
+    mReceived++;
+    c.arrival = now();
+    if (mQueue.push(c))
+      return true;
+    mDropped++;
+    return false;
+  }
+
+  // graphics thread: everything received since the last call, in order,
+  // minus the coalesced commands. out keeps its capacity between frames
+  void drain(std::vector<OscCommand> &out)
+  {
+    out.clear();
+    out.reserve(mQueue.capacity());
+    OscCommand c;
+    while (mQueue.pop(c))
+      out.push_back(c);
+
+    // walk backwards so we know what comes later
+    bool laterPic = false, laterInterp = false;
+    for (size_t i = out.size(); i-- > 0;)
+    {
+      OscCommand::Type type = out[i].type;
+      if ((type == OscCommand::PIC_TYPE && laterPic) || (type == OscCommand::INTERP_VAL && laterInterp))
+        out[i].type = OscCommand::COALESCED;
+      if (type == OscCommand::PIC_TYPE)
+        laterPic = true;
+      if (type == OscCommand::MESH_TYPE)
+        laterPic = false; // it needs the k before it
+      if (type == OscCommand::INTERP_VAL)
+        laterInterp = true;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < out.size(); i++)
+      if (out[i].type != OscCommand::COALESCED)
+        out[kept++] = out[i];
+    mCoalesced += out.size() - kept;
+    out.resize(kept);
+  }
+
+  uint64_t received() const { return mReceived; }
+  uint64_t dropped() const { return mDropped; }     // queue was full
+  uint64_t coalesced() const { return mCoalesced; } // superseded in a frame
+
+private:
+  SpscQueue<OscCommand, 1024> mQueue;
+  std::atomic<uint64_t> mReceived{0}, mDropped{0};
+  uint64_t mCoalesced = 0;
+};
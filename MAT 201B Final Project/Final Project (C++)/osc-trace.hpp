@@ -0,0 +1,228 @@
+#pragma once
+
+// record a show's OSC and play it back, to reproduce what happened in a real
+// run. a trace is a small binary file: an 8 byte header, then 9 bytes per
+// command (microseconds since the previous one, the type, the value).
+//
+// every command is stamped when it is pushed; the frame that applies it
+// reports how long it took from arrival to being on screen.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "osc-commands.hpp"
+
+static const char OSC_TRACE_MAGIC[8] = {'T', 'Y', 'I', 'L', 'O', 'S', 'C', '1'};
+
+// OSC thread: appends every command it is given. the file is closed from
+// the graphics thread while OSC may still be arriving, so a lock (only ever
+// contended then) keeps a late write off a closed file
+class OscRecorder
+{
+public:
+  ~OscRecorder() { close(); }
+
+  bool open(const std::string &path)
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+    mFile = fopen(path.c_str(), "wb");
+    if (!mFile)
+      return false;
+    fwrite(OSC_TRACE_MAGIC, 1, 8, mFile);
+    mLast = OscCommandQueue::now();
+    return true;
+  }
+
+  bool recording()
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mFile;
+  }
+
+  void write(const OscCommand &c)
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!mFile)
+      return;
+    uint64_t t = OscCommandQueue::now();
+    uint32_t delta = std::min<uint64_t>((t - mLast) / 1000, UINT32_MAX);
+    mLast = t;
+    uint8_t type = c.type;
+    int32_t value;
+    if (c.type == OscCommand::PIC_TYPE || c.type == OscCommand::MESH_TYPE)
+      value = c.i;
+    else
+      memcpy(&value, &c.f, 4);
+    fwrite(&delta, 4, 1, mFile);
+    fwrite(&type, 1, 1, mFile);
+    fwrite(&value, 4, 1, mFile);
+    mCount++;
+  }
+
+  uint64_t count() const { return mCount; }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mFile)
+      fclose(mFile);
+    mFile = nullptr;
+  }
+
+private:
+  std::mutex mLock;
+  FILE *mFile = nullptr;
+  uint64_t mLast = 0;
+  uint64_t mCount = 0;
+};
+
+// feeds a trace into the command queue from its own thread, with the
+// original gaps divided by speed
+class OscReplayer
+{
+public:
+  struct Step
+  {
+    uint32_t delta; // microseconds
+    OscCommand command;
+  };
+
+  ~OscReplayer() { stop(); }
+
+  bool open(const std::string &path)
+  {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+      return false;
+    char magic[8];
+    bool ok = fread(magic, 1, 8, f) == 8 && memcmp(magic, OSC_TRACE_MAGIC, 8) == 0;
+    Step s;
+    uint8_t type;
+    int32_t value;
+    while (ok && fread(&s.delta, 4, 1, f) == 1 && fread(&type, 1, 1, f) == 1 && fread(&value, 4, 1, f) == 1)
+    {
+      if (type >= OscCommand::COALESCED)
+        continue;
+      s.command = OscCommand();
+      s.command.type = OscCommand::Type(type);
+      if (type == OscCommand::PIC_TYPE || type == OscCommand::MESH_TYPE)
+        s.command.i = value;
+      else
+        memcpy(&s.command.f, &value, 4);
+      mSteps.push_back(s);
+    }
+    fclose(f);
+    return ok;
+  }
+
+  size_t size() const { return mSteps.size(); }
+  bool done() const { return mDone; }
+
+  void start(OscCommandQueue &queue, float speed)
+  {
+    speed = std::max(speed, 0.001f);
+    mThread = std::thread([this, &queue, speed]() {
+      auto t = std::chrono::steady_clock::now();
+      for (auto &s : mSteps)
+      {
+        if (mStop)
+          break;
+        t += std::chrono::microseconds(uint64_t(s.delta / speed));
+        std::this_thread::sleep_until(t);
+        queue.push(s.command);
+      }
+      mDone = true;
+    });
+  }
+
+  void stop()
+  {
+    mStop = true;
+    if (mThread.joinable())
+      mThread.join();
+  }
+
+private:
+  std::vector<Step> mSteps;
+  std::thread mThread;
+  std::atomic<bool> mStop{false}, mDone{false};
+};
+
+// time from a command's arrival to the end of the frame that applied it, in
+// power of two buckets from 1/8 ms to 1 s, per command type
+class LatencyHistogram
+{
+public:
+  static const int BUCKETS = 15; // the last one is everything above 1 s
+
+  // graphics thread
+  void add(int type, uint64_t arrival, uint64_t frame)
+  {
+    double ms = (frame - std::min(arrival, frame)) / 1e6;
+    int b = 0;
+    while (b < BUCKETS - 1 && ms > 0.125 * (1 << b))
+      b++;
+    mCounts[type][b]++;
+    mCounts[OscCommand::COALESCED][b]++; // all types
+    mMax = std::max(mMax, ms);
+  }
+
+  void print(std::ostream &o) const
+  {
+    static const char *names[] = {"picType", "meshType", "interpVal", "zScale", "rotation", "all"};
+    const uint64_t *all = mCounts[OscCommand::COALESCED];
+    uint64_t total = 0;
+    for (int b = 0; b < BUCKETS; b++)
+      total += all[b];
+    if (total == 0)
+      return;
+    o << "osc to frame latency, " << total << " commands, max " << mMax << " ms" << std::endl;
+    for (int b = 0; b < BUCKETS; b++)
+    {
+      if (!all[b])
+        continue;
+      char line[128];
+      if (b < BUCKETS - 1)
+        snprintf(line, sizeof line, "  <= %8.3f ms %8llu ", 0.125 * (1 << b), (unsigned long long)all[b]);
+      else
+        snprintf(line, sizeof line, "  >  %8.3f ms %8llu ", 0.125 * (1 << (b - 1)), (unsigned long long)all[b]);
+      o << line << std::string(std::max<uint64_t>(1, all[b] * 50 / total), '#') << std::endl;
+    }
+    for (int t = 0; t <= OscCommand::COALESCED; t++)
+    {
+      uint64_t n = 0;
+      for (int b = 0; b < BUCKETS; b++)
+        n += mCounts[t][b];
+      if (n)
+        o << "  " << names[t] << ": " << n << ", p50 <= " << percentile(t, 0.5) << " ms, p99 <= "
+          << percentile(t, 0.99) << " ms" << std::endl;
+    }
+  }
+
+  // the upper edge of the bucket holding the p-th command
+  double percentile(int type, double p) const
+  {
+    uint64_t n = 0;
+    for (int b = 0; b < BUCKETS; b++)
+      n += mCounts[type][b];
+    uint64_t seen = 0;
+    for (int b = 0; b < BUCKETS - 1; b++)
+    {
+      seen += mCounts[type][b];
+      if (seen >= p * n)
+        return 0.125 * (1 << b);
+    }
+    return mMax;
+  }
+
+private:
+  uint64_t mCounts[OscCommand::COALESCED + 1][BUCKETS] = {};
+  double mMax = 0;
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+// binary cache of the precomputed point clouds, one file per source image
+// (rather than one file for all of them, so an image that changes, or is
+// added, is rebuilt on its own without rewriting the rest). the file
+// is a fixed 64 byte header, the bounding box of every layout, the 16 bit
+// positions of every layout one block after another, and then the 8 bit rgba
+// colors they all share (each block holds every level of the pyramid, level 0
+// first):
+//
+//   header | bounds | pic xyz | rgb xyz | hsv xyz | somethingElse xyz | rgba
+//
+// the blocks are in the same format as CompactImage (and as the GPU buffers),
+// so an image served from a mapped file points straight into it: nothing is
+// parsed or copied, and every instance that maps it shares the pages. the header
+// records the size and mtime of the source image and the size it was decoded
+// at; when any of them changes the cache is stale and gets rebuilt. a file is
+// named after the image's full path, so images with the same name in
+// different directories don't share one.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#ifndef _WIN32
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "compact-layouts.hpp"
+
+namespace pointcache
+{
+
+  const char magic[8] = {'T', 'Y', 'I', 'L', 'P', 'T', 'S', 0};
+  const uint32_t version = 4; // 3: points in chunk order, 4: pyramid levels
+
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t layouts;
+    uint32_t width;
+    uint32_t height;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint32_t maxSide; // what ImageLoader::maxSide was
+    uint8_t reserved[20];
+  };
+  static_assert(sizeof(Header) == 64, "point cache header must stay 64 bytes");
+
+  struct Bounds
+  {
+    float origin[3];
+    float extent[3];
+  };
+
+  inline uint64_t fileBytes(uint32_t width, uint32_t height)
+  {
+    uint64_t n = CompactImage::pyramidPoints(width, height);
+    return sizeof(Header) + LAYOUTS * sizeof(Bounds) + LAYOUTS * n * 3 * sizeof(uint16_t) + n * 4;
+  }
+
+  // size and modification time of the source image
+  inline bool sourceStamp(const std::string &file, uint64_t &size, int64_t &mtime)
+  {
+#ifndef _WIN32
+    struct stat st;
+    if (stat(file.c_str(), &st) != 0)
+      return false;
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // where the cache for an image lives, e.g.
+  // pointcache/dove500.jpeg.3f2a9c0d1b7e4f56.pts: its name, for whoever looks
+  // in the directory, and a hash of its full path, so it is the only one there
+  inline std::string cachePath(const std::string &dir, const std::string &image)
+  {
+    std::string full = image;
+#ifndef _WIN32
+    char resolved[PATH_MAX];
+    if (realpath(image.c_str(), resolved))
+      full = resolved;
+#endif
+    uint64_t hash = 14695981039346656037ull; // FNV-1a
+    for (unsigned char c : full)
+      hash = (hash ^ c) * 1099511628211ull;
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+    size_t slash = image.find_last_of("/\\");
+    std::string name = slash == std::string::npos ? image : image.substr(slash + 1);
+    return dir + "/" + name + "." + hex + ".pts";
+  }
+
+  // a read-only mapping of one cache file
+  class Mapped
+  {
+  public:
+    Mapped() {}
+    Mapped(const Mapped &) = delete;
+    Mapped &operator=(const Mapped &) = delete;
+    ~Mapped() { close(); }
+
+    // maps the file and checks it against the source image's stamp
+    bool open(const std::string &path, uint64_t sourceSize, int64_t sourceMtime, uint32_t maxSide)
+    {
+      close();
+#ifndef _WIN32
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+        return false;
+      struct stat st;
+      if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header))
+      {
+        ::close(fd);
+        return false;
+      }
+      void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (p == MAP_FAILED)
+        return false;
+      mData = (const uint8_t *)p;
+      mBytes = st.st_size;
+
+      const Header &h = header();
+      if (memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version ||
+          h.layouts != LAYOUTS || h.sourceSize != sourceSize || h.sourceMtime != sourceMtime ||
+          h.maxSide != maxSide || fileBytes(h.width, h.height) != mBytes)
+      {
+        close();
+        return false;
+      }
+      return true;
+#else
+      return false;
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+      if (mData)
+        munmap((void *)mData, mBytes);
+#endif
+      mData = nullptr;
+      mBytes = 0;
+    }
+
+    bool valid() const { return mData != nullptr; }
+    const Header &header() const { return *(const Header *)mData; }
+    int width() const { return header().width; }
+    int height() const { return header().height; }
+    size_t points() const { return CompactImage::pyramidPoints(header().width, header().height); }
+
+    const Bounds &bounds(int layout) const
+    {
+      return ((const Bounds *)(mData + sizeof(Header)))[layout];
+    }
+    const uint16_t *positions(int layout) const
+    {
+      return (const uint16_t *)(mData + sizeof(Header) + LAYOUTS * sizeof(Bounds)) + layout * 3 * points();
+    }
+    const uint8_t *colors() const
+    {
+      return mData + sizeof(Header) + LAYOUTS * sizeof(Bounds) + LAYOUTS * 3 * points() * sizeof(uint16_t);
+    }
+
+  private:
+    const uint8_t *mData = nullptr;
+    size_t mBytes = 0;
+  };
+
+  // the image as views into a mapped file, nothing copied. the image (and
+  // every copy of it) keeps the file mapped until the last one goes; a cache
+  // rebuilt meanwhile is renamed over it, which leaves this mapping intact
+  inline void share(const std::shared_ptr<const Mapped> &cache, CompactImage &image)
+  {
+    size_t n = cache->points();
+    image.width = cache->width();
+    image.height = cache->height();
+    for (int l = 0; l < LAYOUTS; l++)
+    {
+      CompactLayout &layout = image.layouts[l];
+      const Bounds &b = cache->bounds(l);
+      layout.origin = al::Vec3f(b.origin[0], b.origin[1], b.origin[2]);
+      layout.extent = al::Vec3f(b.extent[0], b.extent[1], b.extent[2]);
+      layout.xyz.clear();
+      layout.mapped = cache->positions(l);
+      layout.mappedPoints = n;
+    }
+    image.rgba.clear();
+    image.mappedRgba = cache->colors();
+    image.mapping = cache;
+  }
+
+  // writes to a temporary file and renames it into place, so a reader never
+  // maps a half-written cache
+  inline bool write(const std::string &path, const CompactImage &image, uint64_t sourceSize, int64_t sourceMtime,
+                    uint32_t maxSide)
+  {
+    size_t n = image.points();
+    if (image.colorBytes() != 4 * n)
+      return false;
+    for (auto &l : image.layouts)
+      if (l.points() != n)
+        return false;
+
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, magic, sizeof(magic));
+    h.version = version;
+    h.layouts = LAYOUTS;
+    h.width = image.width;
+    h.height = image.height;
+    h.sourceSize = sourceSize;
+    h.sourceMtime = sourceMtime;
+    h.maxSide = maxSide;
+
+    Bounds bounds[LAYOUTS];
+    for (int l = 0; l < LAYOUTS; l++)
+      for (int c = 0; c < 3; c++)
+      {
+        bounds[l].origin[c] = image.layouts[l].origin[c];
+        bounds[l].extent[c] = image.layouts[l].extent[c];
+      }
+
+    std::string temp = path + ".tmp";
+    FILE *file = fopen(temp.c_str(), "wb");
+    if (!file)
+      return false;
+    bool ok = fwrite(&h, sizeof(h), 1, file) == 1;
+    ok = ok && fwrite(bounds, sizeof(bounds), 1, file) == 1;
+    for (int l = 0; ok && l < LAYOUTS; l++)
+      ok = fwrite(image.layouts[l].data(), sizeof(uint16_t), 3 * n, file) == 3 * n;
+    ok = ok && fwrite(image.colors(), 1, 4 * n, file) == 4 * n;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0)
+    {
+      remove(temp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  inline void makeDirectory(const std::string &dir)
+  {
+#ifndef _WIN32
+    mkdir(dir.c_str(), 0755);
+#endif
+  }
+
+} // namespace pointcache
@@ -2,14 +2,26 @@
 
 in Fragment {
   vec4 color;
+#ifdef POINT_SPRITES
+  flat vec2 center;
+  flat vec2 halfSize;
+#else
   vec2 mapping;
+#endif
 }
 fragment;
 
 layout(location = 0) out vec4 fragmentColor;
 
 void main() {
-  float r = dot(fragment.mapping, fragment.mapping);
+#ifdef POINT_SPRITES
+  // where this pixel is on the quad the geometry shader would have made
+  // (anything outside it is outside the circle too)
+  vec2 mapping = (gl_FragCoord.xy - fragment.center) / fragment.halfSize;
+#else
+  vec2 mapping = fragment.mapping;
+#endif
+  float r = dot(mapping, mapping);
   if (r > 1) discard;
   fragmentColor = vec4(fragment.color.rgb, 1 - r * r);
 }
\ No newline at end of file
@@ -1,21 +1,81 @@
 #version 400
 
+// with POINT_SPRITES defined (see finalproject.cpp) there is no geometry
+// shader: the point is projected here and drawn as a gl_PointSize sprite a
+// little bigger than the quad point-geometry.glsl would have made.
+// point-fragment.glsl works out where each pixel is on that quad, so the same
+// pixels are covered, with the same alpha, even below a pixel in size.
+//
+// two places where the sprites differ from the quads: a sprite is at most
+// maxPointSize pixels (GL_POINT_SIZE_RANGE, e.g. 255 on llvmpipe), so a
+// splat that would be bigger, close to the camera, is shrunk to fit; and a
+// point is clipped by its center, so a splat whose center leaves the view is
+// dropped whole, up to a radius before the quad would be
+
 layout(location = 0) in vec3 vertexPosition;
 layout(location = 1) in vec4 vertexColor;
+layout(location = 2) in vec3 previousPosition;
 //layout(location = 2) in vec2 vertexSize;
 // vertexSize is 2D texture cordinate, but we only use the x
 
 uniform mat4 al_ModelViewMatrix;
 uniform mat4 al_ProjectionMatrix;
 
+// morph from previousPosition to vertexPosition, same as the old onAnimate
+// loop: t is seconds since the last switch, iVal the /interpVal speed
+uniform float t;
+uniform float iVal;
+// luminance z displacement
+uniform float zScale;
+// the layouts arrive as 16 bit normalized positions inside their bounding
+// boxes; position = origin + position * extent (0 and 1 for float meshes)
+uniform vec3 actualOrigin;
+uniform vec3 actualExtent;
+uniform vec3 previousOrigin;
+uniform vec3 previousExtent;
+
+#ifdef POINT_SPRITES
+// half the width of the quad in eye space, the viewport and the biggest
+// sprite in pixels
+uniform float pointSize;
+uniform vec2 viewportSize;
+uniform float maxPointSize;
+
+out Fragment {
+  vec4 color;
+  // the quad's center and half size in window coordinates
+  flat vec2 center;
+  flat vec2 halfSize;
+}
+fragment;
+#else
 out Vertex {
   vec4 color;
   //float size;
 }
 vertex;
+#endif
 
 void main() {
-  gl_Position = al_ModelViewMatrix * vec4(vertexPosition, 1.0);
+  float a = (t * iVal) / 2.0;
+  vec3 from = previousOrigin + previousPosition * previousExtent;
+  vec3 to = actualOrigin + vertexPosition * actualExtent;
+  vec3 p = from * (1.0 - a) + to * a;
+  p.z += dot(vertexColor.rgb, vec3(0.3, 0.59, 0.11)) * zScale;
+#ifdef POINT_SPRITES
+  gl_Position = al_ProjectionMatrix * al_ModelViewMatrix * vec4(p, 1.0);
+  vec2 scale = vec2(al_ProjectionMatrix[0][0], al_ProjectionMatrix[1][1]);
+  fragment.color = vertexColor;
+  fragment.center = (gl_Position.xy / gl_Position.w * 0.5 + 0.5) * viewportSize;
+  fragment.halfSize = pointSize * scale * viewportSize * 0.5 / gl_Position.w;
+  float size = 2.0 * max(fragment.halfSize.x, fragment.halfSize.y) + 2.0;
+  // past the biggest sprite the whole splat shrinks, rather than being cut
+  // square by the sprite's edges
+  fragment.halfSize *= min(1.0, (maxPointSize - 2.0) / max(size - 2.0, 1.0));
+  gl_PointSize = min(size, maxPointSize);
+#else
+  gl_Position = al_ModelViewMatrix * vec4(p, 1.0);
   vertex.color = vertexColor;
   //vertex.size = 1.0; //vertexSize.x;
-}
\ No newline at end of file
+#endif
+}
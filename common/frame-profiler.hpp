@@ -0,0 +1,218 @@
+#pragma once
+
+// scoped timers for the phases of a frame. PROFILE("name") times the rest of
+// the enclosing block; PROFILE_FRAME() (once a frame, at the end of onDraw)
+// closes the frame. the times go to
+//  - a ProfilerPanel: a GUI panel of read-only parameters with every phase's
+//    time this frame, its average and the heap in use, and
+//  - a trace: every timed block of the session (the last 256k of them),
+//    which profiler().writeTrace() saves as Chrome trace-event JSON (open it
+//    in chrome://tracing or ui.perfetto.dev).
+//
+// building with -DFRAME_PROFILER=0 compiles all of it out: the macros are
+// empty and the panel has nothing in it.
+
+#ifndef FRAME_PROFILER
+#define FRAME_PROFILER 1
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "al/app/al_GUIDomain.hpp"
+#include "al/ui/al_Parameter.hpp"
+
+#if FRAME_PROFILER
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+class FrameProfiler;
+FrameProfiler& profiler();  // the one every PROFILE reports to
+
+class FrameProfiler {
+ public:
+  struct Phase {
+    double sum = 0;   // seconds so far this frame
+    double last = 0;  // seconds in the last whole frame
+    double average = 0;
+    double max = 0;
+  };
+
+  // a timed block
+  class Scope {
+   public:
+    explicit Scope(const char* name)
+        : name(name), begin(std::chrono::steady_clock::now()) {}
+    ~Scope() { profiler().add(name, begin, std::chrono::steady_clock::now()); }
+
+   private:
+    const char* name;
+    std::chrono::steady_clock::time_point begin;
+  };
+
+  FrameProfiler() : start(std::chrono::steady_clock::now()) {}
+
+  void add(const char* name, std::chrono::steady_clock::time_point begin,
+           std::chrono::steady_clock::time_point end) {
+    static std::atomic<int> threads{0};
+    thread_local int thread = threads++;
+    double seconds = std::chrono::duration<double>(end - begin).count();
+    std::lock_guard<std::mutex> lock(mutex);
+    phases[name].sum += seconds;
+    Event& e = events[written++ % events.size()];
+    e.name = name;
+    e.thread = thread;
+    e.begin = std::chrono::duration<double, std::micro>(begin - start).count();
+    e.duration = seconds * 1e6;
+  }
+
+  // end of a frame: the sums become this frame's times
+  void frame() {
+    std::lock_guard<std::mutex> lock(mutex);
+    frames++;
+    for (auto& p : phases) {
+      Phase& phase = p.second;
+      phase.last = phase.sum;
+      phase.average += (phase.last - phase.average) * 0.05;
+      if (phase.last > phase.max) phase.max = phase.last;
+      phase.sum = 0;
+    }
+  }
+
+  Phase phase(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto p = phases.find(name);
+    return p == phases.end() ? Phase() : p->second;
+  }
+
+  // bytes the allocator has handed out and not got back, 0 if unknown
+  static size_t heapBytes() {
+#if defined(__APPLE__)
+    malloc_statistics_t stats;
+    malloc_zone_statistics(nullptr, &stats);
+    return stats.size_in_use;
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+  }
+
+  // the trace so far as Chrome trace-event JSON
+  bool writeTrace(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    size_t n = written < events.size() ? written : events.size();
+    for (size_t i = 0; i < n; i++) {
+      const Event& e = events[(written - n + i) % events.size()];
+      fprintf(f,
+              "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+              "\"ts\": %.3f, \"dur\": %.3f}\n",
+              i ? "," : "", e.name, e.thread, e.begin, e.duration);
+    }
+    fprintf(f, "]}\n");
+    fclose(f);
+    return true;
+  }
+
+  uint64_t frameCount() const { return frames; }
+
+ private:
+  struct Event {
+    const char* name;
+    int thread;
+    double begin, duration;  // microseconds
+  };
+
+  std::mutex mutex;
+  std::map<std::string, Phase> phases;
+  std::vector<Event> events = std::vector<Event>(1 << 18);
+  size_t written = 0;
+  uint64_t frames = 0;
+  std::chrono::steady_clock::time_point start;
+};
+
+inline FrameProfiler& profiler() {
+  static FrameProfiler p;
+  return p;
+}
+
+#define PROFILE_JOIN2(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN2(a, b)
+#define PROFILE(name) \
+  FrameProfiler::Scope PROFILE_JOIN(profileScope, __LINE__)(name)
+#define PROFILE_FRAME() profiler().frame()
+
+// one read-only slider per phase (milliseconds this frame, and a running
+// average), plus the heap in use, in its own GUI panel. writeTrace is a
+// button that saves the trace to the given file
+class ProfilerPanel {
+ public:
+  void add(al::GUIDomain& domain, const std::vector<std::string>& names,
+           const std::string& tracePath = "trace.json") {
+    auto& gui = domain.newGUI();
+    for (auto& name : names) {
+      auto now = std::make_shared<al::Parameter>(name + "_ms", "", 0, "", 0, 33);
+      auto average =
+          std::make_shared<al::Parameter>(name + "_avg_ms", "", 0, "", 0, 33);
+      gui.add(*now);
+      gui.add(*average);
+      rows.push_back({name, now, average});
+    }
+    heap = std::make_shared<al::Parameter>("heap_MB", "", 0, "", 0, 1024);
+    gui.add(*heap);
+    writeTrace = std::make_shared<al::ParameterBool>("writeTrace", "", 0.0);
+    writeTrace->registerChangeCallback([this, tracePath](float on) {
+      if (on && profiler().writeTrace(tracePath))
+        printf("wrote %s\n", tracePath.c_str());
+    });
+    gui.add(*writeTrace);
+  }
+
+  // graphics thread, once a frame after PROFILE_FRAME()
+  void update() {
+    for (auto& row : rows) {
+      FrameProfiler::Phase p = profiler().phase(row.name);
+      row.now->setNoCalls(p.last * 1000);
+      row.average->setNoCalls(p.average * 1000);
+    }
+    if (heap) heap->setNoCalls(FrameProfiler::heapBytes() / (1024.0 * 1024.0));
+  }
+
+ private:
+  struct Row {
+    std::string name;
+    std::shared_ptr<al::Parameter> now, average;
+  };
+  std::vector<Row> rows;
+  std::shared_ptr<al::Parameter> heap;
+  std::shared_ptr<al::ParameterBool> writeTrace;
+};
+
+#else
+
+#define PROFILE(name)
+#define PROFILE_FRAME()
+
+class ProfilerPanel {
+ public:
+  void add(al::GUIDomain&, const std::vector<std::string>&,
+           const std::string& = "") {}
+  void update() {}
+};
+
+#endif
@@ -0,0 +1,209 @@
+#pragma once
+
+// a simulation on its own thread, stepping at a fixed rate whatever the frame
+// rate is, and a lock-free triple buffer that hands its state to the graphics
+// thread.
+//
+// the simulation writes each step into the back slot of a TripleBuffer and
+// publish()es it; the graphics thread update()s to the newest one whenever it
+// draws. neither ever waits for the other: of the three slots one is being
+// written, one is being read and the third holds the latest complete step,
+// swapped between them with one atomic exchange. PositionSnapshots keeps the
+// last two steps on the graphics side and draws the positions in between, so
+// the motion is smooth when the two rates differ.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+
+template <typename T>
+class TripleBuffer {
+ public:
+  // before either side starts: every slot a copy of value (e.g. to size them)
+  void fill(const T& value) {
+    for (auto& s : slots) s = value;
+  }
+
+  // writer: the slot to fill, then publish() it
+  T& back() { return slots[backIndex]; }
+  void publish() {
+    backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) &
+                INDEX;
+  }
+
+  // reader: front() becomes the newest published slot; false if there is
+  // nothing newer than the one it already has
+  bool update() {
+    if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+    frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+  const T& front() const { return slots[frontIndex]; }
+
+ private:
+  enum { INDEX = 3, FRESH = 4 };
+  T slots[3];
+  int backIndex = 0;
+  int frontIndex = 1;
+  std::atomic<int> middle{2};  // the slot between them, and whether it's new
+};
+
+// events a second, counted over about a second. tick() from one thread at a
+// time, perSecond() from any
+class RateMeter {
+ public:
+  void tick() {
+    int64_t now = nanoseconds();
+    last = now;
+    if (since < 0) since = now;
+    count++;
+    if (now - since >= 1000000000) {
+      rate = count * 1e9 / (now - since);
+      count = 0;
+      since = now;
+    }
+  }
+
+  // 0 once the ticks have stopped for a couple of seconds
+  double perSecond() const {
+    return nanoseconds() - last > 2000000000 ? 0 : rate.load();
+  }
+
+ private:
+  static int64_t nanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  int64_t since = -1;
+  int64_t count = 0;
+  std::atomic<int64_t> last{0};
+  std::atomic<double> rate{0};
+};
+
+// calls step(t) on its own thread, rate() times a second until stop(). t is
+// the time the step stands for on the clock of now(): one period after the
+// last, however late the thread got to it
+class SimThread {
+ public:
+  ~SimThread() { stop(); }
+
+  void start(double stepsPerSecond, std::function<void(double)> step) {
+    stop();
+    rate(stepsPerSecond);
+    stopping = false;
+    thread = std::thread([this, step]() { run(step); });
+  }
+
+  // returns once the last step has finished
+  void stop() {
+    if (!thread.joinable()) return;
+    stopping = true;
+    thread.join();
+  }
+
+  bool running() const { return thread.joinable(); }
+  void rate(double stepsPerSecond) {
+    period = 1 / std::max(stepsPerSecond, 1.0);
+  }
+  double interval() const { return period; }
+
+  static double now() {
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+ private:
+  void run(const std::function<void(double)>& step) {
+    double next = now();
+    while (!stopping) {
+      double t = now();
+      if (t < next) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(next - t));
+        continue;
+      }
+      step(next);
+      next += period;
+      // steps that take longer than the period: drop the backlog rather than
+      // run flat out trying to catch up
+      if (now() - next > 4 * period) next = now();
+    }
+  }
+
+  std::thread thread;
+  std::atomic<bool> stopping{false};
+  std::atomic<double> period{1 / 60.0};
+};
+
+// positions handed from the simulation thread to the graphics thread, one
+// snapshot a step. a step can have fewer positions than there is room for,
+// and a layout: a number that changes whenever which particle is where does
+// (e.g. ParticlePool::layout()). steps with different layouts aren't blended
+class PositionSnapshots {
+ public:
+  // before the simulation thread starts: the state it starts from, with room
+  // for as many as capacity positions a step
+  void reset(const std::vector<al::Vec3f>& positions, double time,
+             uint64_t layout = 0, size_t capacity = 0) {
+    latestStep = {positions, positions.size(), time, layout};
+    latestStep.positions.resize(std::max(capacity, positions.size()));
+    previousStep = latestStep;
+    buffer.fill(latestStep);
+  }
+
+  // simulation thread: write the step's positions here, then publish() them
+  al::Vec3f* back() { return buffer.back().positions.data(); }
+  void publish(double time) {
+    publish(time, buffer.back().count, buffer.back().layout);
+  }
+  void publish(double time, size_t count, uint64_t layout) {
+    buffer.back().count = count;
+    buffer.back().time = time;
+    buffer.back().layout = layout;
+    buffer.publish();
+  }
+
+  // graphics thread: the positions at time t, between the last two steps
+  // published (the newest, if t is past it, or if the particles changed
+  // between them); returns how many
+  size_t interpolate(double t, al::Vec3f* out) {
+    if (buffer.update()) {
+      std::swap(previousStep, latestStep);
+      latestStep = buffer.front();  // into the vector that's already there
+    }
+    double span = latestStep.time - previousStep.time;
+    float f = span > 0 ? float((t - previousStep.time) / span) : 1;
+    f = std::min(std::max(f, 0.0f), 1.0f);
+    if (previousStep.layout != latestStep.layout) f = 1;
+    const auto& a = previousStep.positions;
+    const auto& b = latestStep.positions;
+    for (size_t i = 0; i < latestStep.count; i++)
+      out[i] = a[i] + (b[i] - a[i]) * f;
+    return latestStep.count;
+  }
+
+  // graphics thread: the newest step's positions (the first size() of them),
+  // and its layout
+  const std::vector<al::Vec3f>& latest() const { return latestStep.positions; }
+  size_t size() const { return latestStep.count; }
+  uint64_t layout() const { return latestStep.layout; }
+
+ private:
+  struct Snapshot {
+    std::vector<al::Vec3f> positions;
+    size_t count = 0;
+    double time = 0;
+    uint64_t layout = 0;
+  };
+
+  TripleBuffer<Snapshot> buffer;
+  Snapshot previousStep, latestStep;
+};
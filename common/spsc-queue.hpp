@@ -0,0 +1,40 @@
+#pragma once
+
+// a fixed-size, lock-free ring buffer for exactly one producer thread and one
+// consumer thread. push() and pop() never block and never allocate; push()
+// fails when the ring is full.
+
+#include <atomic>
+#include <cstddef>
+
+template <class T, size_t N>
+class SpscQueue {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+ public:
+  // producer thread only
+  bool push(const T& item) {
+    size_t head = mHead.load(std::memory_order_relaxed);
+    if (head - mTail.load(std::memory_order_acquire) == N) return false;
+    mItems[head & (N - 1)] = item;
+    mHead.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer thread only
+  bool pop(T& item) {
+    size_t tail = mTail.load(std::memory_order_relaxed);
+    if (tail == mHead.load(std::memory_order_acquire)) return false;
+    item = mItems[tail & (N - 1)];
+    mTail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  static constexpr size_t capacity() { return N; }
+
+ private:
+  // head and tail on their own cache lines so the two threads don't share one
+  alignas(64) std::atomic<size_t> mHead{0};
+  alignas(64) std::atomic<size_t> mTail{0};
+  alignas(64) T mItems[N];
+};
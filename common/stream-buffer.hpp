@@ -0,0 +1,306 @@
+#pragma once
+
+// vertex data that changes every frame, written straight into GPU memory.
+//
+// a StreamBuffer is one buffer split into a ring of regions (3 by default),
+// one per frame. a frame begin()s the next region, writes into it through a
+// pointer, end()s it (which flushes only the ranges it wrote) and fence()s it
+// after the draws that read it. the region comes round again two frames
+// later, by when the GPU has long finished with it, so the fence wait is
+// normally free, and nothing is copied on the way: no vector to glBufferData,
+// no driver staging copy, no stall on a buffer the GPU is still drawing from.
+//
+// with GL 4.4 (or ARB_buffer_storage) the whole buffer stays mapped for its
+// lifetime (persistent, explicitly flushed). without it (e.g. macOS, 4.1)
+// each region is mapped unsynchronized for the frame instead, which the
+// fences make safe in the same way.
+//
+// StreamMesh puts a mesh's per-frame attributes on top of one: positions
+// and, optionally, colors and texture coordinates, with the same attribute
+// locations as al::Mesh, plus fixed attributes uploaded once.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "al/graphics/al_BufferObject.hpp"
+#include "al/graphics/al_Graphics.hpp"
+#include "al/graphics/al_OpenGL.hpp"
+#include "al/graphics/al_VAO.hpp"
+
+class StreamBuffer {
+ public:
+  StreamBuffer() {}
+  StreamBuffer(const StreamBuffer&) = delete;
+  StreamBuffer& operator=(const StreamBuffer&) = delete;
+  ~StreamBuffer() { destroy(); }
+
+  // graphics thread: room for bytes a frame, in frames regions. persistent =
+  // false forces the mapped-per-frame path
+  void create(size_t bytes, int frames = 3, bool persistent = true) {
+    destroy();
+    regionBytes = (std::max<size_t>(bytes, 1) + 255) / 256 * 256;
+    fences.assign(std::max(frames, 2), nullptr);
+    isPersistent = persistent && (GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage);
+    size_t total = regionBytes * fences.size();
+
+    buffer.bufferType(GL_ARRAY_BUFFER);
+    buffer.create();
+    buffer.bind();
+    if (isPersistent) {
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT;
+      glBufferStorage(GL_ARRAY_BUFFER, total, nullptr, flags);
+      mapped = (uint8_t*)glMapBufferRange(GL_ARRAY_BUFFER, 0, total,
+                                          flags | GL_MAP_FLUSH_EXPLICIT_BIT);
+    } else {
+      glBufferData(GL_ARRAY_BUFFER, total, nullptr, GL_STREAM_DRAW);
+    }
+    buffer.unbind();
+    region = -1;
+  }
+
+  void destroy() {
+    for (auto& f : fences)
+      if (f) glDeleteSync(f);
+    fences.clear();
+    if (buffer.created()) buffer.destroy();  // unmaps too
+    mapped = nullptr;
+    region = -1;
+  }
+
+  bool created() const { return !fences.empty(); }
+  bool persistent() const { return isPersistent; }
+  size_t capacity() const { return regionBytes; }
+  al::BufferObject& object() { return buffer; }
+
+  // start writing the next region; waits only if the GPU is still reading
+  // it. returns capacity() bytes to write into
+  uint8_t* begin() {
+    region = (region + 1) % fences.size();
+    wait(fences[region]);
+    fences[region] = nullptr;
+    dirty.clear();
+    if (isPersistent) return mapped + offset();
+    buffer.bind();
+    uint8_t* p = (uint8_t*)glMapBufferRange(
+        GL_ARRAY_BUFFER, offset(), regionBytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+            GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+    buffer.unbind();
+    return p;
+  }
+
+  // [from, from + bytes) of the region has been written
+  void written(size_t from, size_t bytes) {
+    if (bytes == 0) return;
+    // merge with the last range if they touch, e.g. the attributes of a
+    // vertex layout written one after the other
+    if (!dirty.empty() && dirty.back().second == from)
+      dirty.back().second = from + bytes;
+    else
+      dirty.push_back({from, from + bytes});
+  }
+
+  // the writes go to the GPU (only the written ranges). returns where the
+  // region starts in the buffer, for the attribute pointers
+  size_t end() {
+    buffer.bind();
+    size_t base = isPersistent ? offset() : 0;  // relative to the mapping
+    for (auto& d : dirty) {
+      glFlushMappedBufferRange(GL_ARRAY_BUFFER, base + d.first,
+                               d.second - d.first);
+      flushedBytes += d.second - d.first;
+    }
+    if (!isPersistent) glUnmapBuffer(GL_ARRAY_BUFFER);
+    buffer.unbind();
+    return offset();
+  }
+
+  // after the draws that read the last end()ed region
+  void fence() {
+    if (region < 0) return;
+    if (fences[region]) glDeleteSync(fences[region]);
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+
+  // begin()s that had to wait for the GPU, how long in all, and the bytes
+  // flushed
+  uint64_t stalls() const { return stallCount; }
+  double stallSeconds() const { return stallTime; }
+  uint64_t flushed() const { return flushedBytes; }
+
+ private:
+  size_t offset() const { return size_t(region) * regionBytes; }
+
+  void wait(GLsync f) {
+    if (!f) return;
+    GLenum r = glClientWaitSync(f, 0, 0);
+    if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED) {
+      auto t0 = std::chrono::steady_clock::now();
+      stallCount++;
+      do
+        r = glClientWaitSync(f, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+      while (r == GL_TIMEOUT_EXPIRED);
+      stallTime += std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - t0)
+                       .count();
+    }
+    glDeleteSync(f);
+  }
+
+  al::BufferObject buffer;
+  uint8_t* mapped = nullptr;
+  size_t regionBytes = 0;
+  std::vector<GLsync> fences;  // one per region
+  int region = -1;             // the one being (or last) written
+  std::vector<std::pair<size_t, size_t>> dirty;
+  bool isPersistent = false;
+  uint64_t stallCount = 0, flushedBytes = 0;
+  double stallTime = 0;
+};
+
+// a mesh whose positions (and colors and texture coordinates, if asked for)
+// are written every frame into a StreamBuffer. the fixed attributes, e.g.
+// colors and sizes that seldom change, are uploaded once and then only where
+// they changed
+class StreamMesh {
+ public:
+  // as al::Mesh binds them, so the usual shaders work
+  enum Attribute { POSITION = 0, COLOR = 1, TEXCOORD = 2 };
+
+  al::Vec3f* positions = nullptr;  // valid between begin() and end()
+  al::Color* colors = nullptr;     // only with streamed colors
+  al::Vec2f* texCoords = nullptr;  // only with streamed texture coordinates
+
+  void create(size_t maxVertices, bool streamColors,
+              bool streamTexCoords = false) {
+    capacity = maxVertices;
+    streamsColors = streamColors;
+    streamsTexCoords = streamTexCoords;
+    size_t vertexBytes = sizeof(al::Vec3f) +
+                         (streamColors ? sizeof(al::Color) : 0) +
+                         (streamTexCoords ? sizeof(al::Vec2f) : 0);
+    stream.create(capacity * vertexBytes);
+    vertices = 0;
+    fixedColorRoom = fixedTexCoordRoom = 0;
+    if (!vao.created()) vao.create();
+  }
+
+  bool created() const { return stream.created(); }
+  size_t size() const { return vertices; }
+  StreamBuffer& buffer() { return stream; }
+
+  // fixed attributes, uploaded once; or only the vertices [from, to) that
+  // changed, into buffers with room for them all
+  void fixedColors(const std::vector<al::Color>& c) {
+    fixedColors(c.data(), 0, c.size());
+  }
+  void fixedColors(const al::Color* c, size_t from, size_t to) {
+    if (fixedColorRoom != capacity) {
+      allocate(fixedColorBuffer, capacity * sizeof(al::Color));
+      fixedColorRoom = capacity;
+      vao.bind();  // the attribute state goes to whichever VAO is bound
+      vao.enableAttrib(COLOR);
+      vao.attribPointer(COLOR, fixedColorBuffer, 4, GL_FLOAT);
+      vao.unbind();
+    }
+    update(fixedColorBuffer, c, from, to);
+  }
+  void fixedTexCoords(const std::vector<al::Vec2f>& t) {
+    fixedTexCoords(t.data(), 0, t.size());
+  }
+  void fixedTexCoords(const al::Vec2f* t, size_t from, size_t to) {
+    if (fixedTexCoordRoom != capacity) {
+      allocate(fixedTexCoordBuffer, capacity * sizeof(al::Vec2f));
+      fixedTexCoordRoom = capacity;
+      vao.bind();
+      vao.enableAttrib(TEXCOORD);
+      vao.attribPointer(TEXCOORD, fixedTexCoordBuffer, 2, GL_FLOAT);
+      vao.unbind();
+    }
+    update(fixedTexCoordBuffer, t, from, to);
+  }
+
+  // graphics thread: point positions (and colors and texture coordinates)
+  // at this frame's memory
+  void begin() {
+    uint8_t* p = stream.begin();
+    positions = (al::Vec3f*)p;
+    colors = streamsColors ? (al::Color*)(p + colorOffset()) : nullptr;
+    texCoords =
+        streamsTexCoords ? (al::Vec2f*)(p + texCoordOffset()) : nullptr;
+  }
+
+  // the first n of them were written
+  void end(size_t n) {
+    vertices = std::min(n, capacity);
+    stream.written(0, vertices * sizeof(al::Vec3f));
+    if (streamsColors)
+      stream.written(colorOffset(), vertices * sizeof(al::Color));
+    if (streamsTexCoords)
+      stream.written(texCoordOffset(), vertices * sizeof(al::Vec2f));
+    base = stream.end();
+    positions = nullptr;
+    colors = nullptr;
+    texCoords = nullptr;
+  }
+
+  // the last frame written, with whatever shader is bound (g.shader(...) or
+  // g.meshColor() and so on); drawing again without a new frame costs no
+  // upload at all
+  void draw(al::Graphics& g, GLenum primitive) {
+    if (vertices == 0) return;
+    g.update();  // the shader and its matrices
+    vao.bind();
+    vao.enableAttrib(POSITION);
+    vao.attribPointer(POSITION, stream.object(), 3, GL_FLOAT, GL_FALSE, 0,
+                      (const void*)base);
+    if (streamsColors) {
+      vao.enableAttrib(COLOR);
+      vao.attribPointer(COLOR, stream.object(), 4, GL_FLOAT, GL_FALSE, 0,
+                        (const void*)(base + colorOffset()));
+    }
+    if (streamsTexCoords) {
+      vao.enableAttrib(TEXCOORD);
+      vao.attribPointer(TEXCOORD, stream.object(), 2, GL_FLOAT, GL_FALSE, 0,
+                        (const void*)(base + texCoordOffset()));
+    }
+    glDrawArrays(primitive, 0, vertices);
+    vao.unbind();
+    stream.fence();
+  }
+
+ private:
+  // where each attribute's run starts in a region: positions, colors,
+  // texture coordinates
+  size_t colorOffset() const { return capacity * sizeof(al::Vec3f); }
+  size_t texCoordOffset() const {
+    return colorOffset() + (streamsColors ? capacity * sizeof(al::Color) : 0);
+  }
+
+  static void allocate(al::BufferObject& b, size_t bytes) {
+    b.bufferType(GL_ARRAY_BUFFER);
+    b.usage(GL_STATIC_DRAW);
+    if (!b.created()) b.create();
+    b.bind();
+    b.data(bytes, nullptr);
+    b.unbind();
+  }
+
+  template <typename T>
+  void update(al::BufferObject& b, const T* data, size_t from, size_t to) {
+    to = std::min(to, capacity);
+    if (from >= to) return;
+    b.bind();
+    b.subdata(from * sizeof(T), (to - from) * sizeof(T), data + from);
+    b.unbind();
+  }
+
+  StreamBuffer stream;
+  al::VAO vao;
+  al::BufferObject fixedColorBuffer, fixedTexCoordBuffer;
+  size_t capacity = 0, vertices = 0, base = 0;
+  size_t fixedColorRoom = 0, fixedTexCoordRoom = 0;  // 0 for not made yet
+  bool streamsColors = false, streamsTexCoords = false;
+};
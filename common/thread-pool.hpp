@@ -0,0 +1,90 @@
+#pragma once
+
+// a small persistent pool of worker threads for data-parallel loops.
+// parallelFor() splits [0, n) into one contiguous range per thread, runs
+// them (the calling thread takes the first range) and returns when all are
+// done, so it can be called every frame without spawning threads.
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ThreadPool {
+  // threads = 0 uses every core
+  explicit ThreadPool(int threads = 0) {
+    if (threads <= 0) threads = std::thread::hardware_concurrency();
+    if (threads <= 0) threads = 1;
+    for (int i = 1; i < threads; i++)
+      workers.emplace_back([this, i]() { work(i); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& w : workers) w.join();
+  }
+
+  int size() const { return workers.size() + 1; }
+
+  // range(begin, end) is called once per thread with a piece of [0, n);
+  // piece boundaries are multiples of align (e.g. the SIMD width)
+  void parallelFor(size_t n, const std::function<void(size_t, size_t)>& range,
+                   size_t align = 1) {
+    int threads = size();
+    if (threads == 1 || n < align * 2) {
+      range(0, n);
+      return;
+    }
+    size_t piece = (n + threads - 1) / threads;
+    piece = (piece + align - 1) / align * align;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      job = &range;
+      jobSize = n;
+      jobPiece = piece;
+      remaining = threads - 1;
+      generation++;
+    }
+    wake.notify_all();
+    range(0, std::min(piece, n));
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]() { return remaining == 0; });
+    job = nullptr;
+  }
+
+ private:
+  void work(int index) {
+    unsigned seen = 0;
+    while (true) {
+      const std::function<void(size_t, size_t)>* f;
+      size_t begin, end;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&]() { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+        f = job;
+        begin = std::min(jobPiece * index, jobSize);
+        end = std::min(begin + jobPiece, jobSize);
+      }
+      if (begin < end) (*f)(begin, end);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--remaining == 0) finished.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake, finished;
+  const std::function<void(size_t, size_t)>* job = nullptr;
+  size_t jobSize = 0, jobPiece = 0;
+  int remaining = 0;
+  unsigned generation = 0;
+  bool stopping = false;
+};